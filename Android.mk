@@ -10,6 +10,7 @@ LOCAL_SRC_FILES := \
     src/load.c \
     src/memory.c \
     src/pack_unpack.c \
+    src/scan.c \
     src/strbuffer.c \
     src/strconv.c \
     src/utf.c \
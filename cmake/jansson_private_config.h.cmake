@@ -1,5 +1,6 @@
 #cmakedefine HAVE_ENDIAN_H 1
 #cmakedefine HAVE_FCNTL_H 1
+#cmakedefine HAVE_PTHREAD_H 1
 #cmakedefine HAVE_SCHED_H 1
 #cmakedefine HAVE_UNISTD_H 1
 #cmakedefine HAVE_SYS_PARAM_H 1
@@ -17,6 +18,8 @@
 
 #cmakedefine HAVE_SYNC_BUILTINS 1
 #cmakedefine HAVE_ATOMIC_BUILTINS 1
+#cmakedefine HAVE_X86_INTRINSICS 1
+#cmakedefine HAVE_THREAD_LOCAL 1
 
 #cmakedefine HAVE_LOCALE_H 1
 #cmakedefine HAVE_SETLOCALE 1
@@ -47,3 +50,6 @@
 
 #cmakedefine USE_URANDOM 1
 #cmakedefine USE_WINDOWS_CRYPTOAPI 1
+#cmakedefine USE_WYHASH 1
+#cmakedefine USE_NODE_POOLS 1
+#cmakedefine USE_MEMORY_STATS 1
@@ -22,16 +22,101 @@
 #define MAX_INTEGER_STR_LENGTH  100
 #define MAX_REAL_STR_LENGTH     100
 
+/* Size of the output buffer used by json_dump_callback() */
+#define DUMP_BUFFER_SIZE        4096
+
+/* Objects with fewer keys than this are sorted by insertion sort */
+#define INSERTION_SORT_SIZE     10
+
 struct object_key {
-    size_t serial;
+    size_t chunk;
+    size_t rest;
     const char *key;
+    size_t len;
+    void *iter;
 };
 
+/* Encoder output is gathered in buffer and handed to the callback a
+   buffer full at a time. If size is 0, each write goes straight to
+   the callback. */
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t length;
+    json_dump_callback_t callback;
+    void *data;
+} dump_buffer_t;
+
+static int dump_flush(dump_buffer_t *out)
+{
+    size_t length = out->length;
+
+    if(length == 0)
+        return 0;
+
+    out->length = 0;
+    return out->callback(out->buffer, length, out->data);
+}
+
+static JSON_INLINE int dump_write(dump_buffer_t *out, const char *bytes, size_t size)
+{
+    if(size <= out->size - out->length) {
+        memcpy(out->buffer + out->length, bytes, size);
+        out->length += size;
+        return 0;
+    }
+
+    if(dump_flush(out))
+        return -1;
+
+    /* Doesn't fit in an empty buffer either, pass it on as is */
+    if(size > out->size)
+        return out->callback(bytes, size, out->data);
+
+    memcpy(out->buffer, bytes, size);
+    out->length = size;
+    return 0;
+}
+
+/* Return a pointer to size free bytes at the end of the buffer,
+   flushing it first if needed. *space is set to NULL if the buffer
+   is too small to ever hold size bytes. */
+static int dump_reserve(dump_buffer_t *out, size_t size, char **space)
+{
+    if(size > out->size - out->length && dump_flush(out))
+        return -1;
+
+    if(size > out->size - out->length)
+        *space = NULL;
+    else
+        *space = out->buffer + out->length;
+    return 0;
+}
+
 static int dump_to_strbuffer(const char *buffer, size_t size, void *data)
 {
     return strbuffer_append_bytes((strbuffer_t *)data, buffer, size);
 }
 
+struct buffer {
+    const size_t size;
+    size_t used;
+    char *data;
+};
+
+static int dump_to_buffer(const char *buffer, size_t size, void *data)
+{
+    struct buffer *buf = (struct buffer *)data;
+
+    if(buf->data && size <= buf->size - buf->used)
+        memcpy(buf->data + buf->used, buffer, size);
+    else
+        buf->data = NULL;  /* doesn't fit, only count the rest */
+
+    buf->used += size;
+    return 0;
+}
+
 static int dump_to_file(const char *buffer, size_t size, void *data)
 {
     FILE *dest = (FILE *)data;
@@ -43,34 +128,34 @@ static int dump_to_file(const char *buffer, size_t size, void *data)
 /* 32 spaces (the maximum indentation size) */
 static const char whitespace[] = "                                ";
 
-static int dump_indent(size_t flags, int depth, int space, json_dump_callback_t dump, void *data)
+static int dump_indent(size_t flags, int depth, int space, dump_buffer_t *out)
 {
     if(JSON_INDENT(flags) > 0)
     {
         int i, ws_count = JSON_INDENT(flags);
 
-        if(dump("\n", 1, data))
+        if(dump_write(out, "\n", 1))
             return -1;
 
         for(i = 0; i < depth; i++)
         {
-            if(dump(whitespace, ws_count, data))
+            if(dump_write(out, whitespace, ws_count))
                 return -1;
         }
     }
     else if(space && !(flags & JSON_COMPACT))
     {
-        return dump(" ", 1, data);
+        return dump_write(out, " ", 1);
     }
     return 0;
 }
 
-static int dump_string(const char *str, size_t len, json_dump_callback_t dump, void *data, size_t flags)
+static int dump_string(const char *str, size_t len, dump_buffer_t *out, size_t flags)
 {
     const char *pos, *end, *lim;
     int32_t codepoint;
 
-    if(dump("\"", 1, data))
+    if(dump_write(out, "\"", 1))
         return -1;
 
     end = pos = str;
@@ -103,7 +188,7 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
         }
 
         if(pos != str) {
-            if(dump(str, pos - str, data))
+            if(dump_write(out, str, pos - str))
                 return -1;
         }
 
@@ -149,74 +234,279 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
             }
         }
 
-        if(dump(text, length, data))
+        if(dump_write(out, text, length))
             return -1;
 
         str = pos = end;
     }
 
-    return dump("\"", 1, data);
+    return dump_write(out, "\"", 1);
 }
 
-static int object_key_compare_keys(const void *key1, const void *key2)
+#define CHUNK_SIZE  sizeof(size_t)
+
+/* Load the chunk of each key at depth: the next CHUNK_SIZE bytes of
+   the key as a big endian number, padded with zeros, and the number
+   of bytes that were left. Comparing (chunk, rest) pairs orders keys
+   by those bytes, and a key before the longer keys it's a prefix
+   of. */
+static void load_chunks(struct object_key *keys, size_t size, size_t depth)
 {
-    return strcmp(((const struct object_key *)key1)->key,
-                  ((const struct object_key *)key2)->key);
+    size_t i, j, n;
+
+    for(i = 0; i < size; i++)
+    {
+        const unsigned char *key = (const unsigned char *)keys[i].key;
+        size_t chunk = 0;
+
+        n = keys[i].len - depth;
+        if(n > CHUNK_SIZE)
+            n = CHUNK_SIZE;
+
+        for(j = 0; j < CHUNK_SIZE; j++)
+            chunk = (chunk << 8) | (j < n ? key[depth + j] : 0);
+
+        keys[i].chunk = chunk;
+        keys[i].rest = n;
+    }
+}
+
+static JSON_INLINE int chunk_compare(const struct object_key *a,
+                                     size_t chunk, size_t rest)
+{
+    if(a->chunk != chunk)
+        return a->chunk < chunk ? -1 : 1;
+    return a->rest < rest ? -1 : a->rest == rest ? 0 : 1;
+}
+
+/* Compare two keys whose first depth bytes are equal */
+static int object_key_compare(const struct object_key *a,
+                              const struct object_key *b, size_t depth)
+{
+    size_t len = (a->len < b->len ? a->len : b->len) - depth;
+    int result;
+
+    result = memcmp(a->key + depth, b->key + depth, len);
+    if(result)
+        return result;
+
+    return a->len < b->len ? -1 : a->len == b->len ? 0 : 1;
+}
+
+static JSON_INLINE void object_key_swap(struct object_key *a,
+                                        struct object_key *b)
+{
+    struct object_key tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* Returns the median of three keys by their chunks */
+static const struct object_key *median_of_three(const struct object_key *a,
+                                                const struct object_key *b,
+                                                const struct object_key *c)
+{
+    if(chunk_compare(a, b->chunk, b->rest) < 0)
+    {
+        if(chunk_compare(b, c->chunk, c->rest) < 0)
+            return b;
+        return chunk_compare(a, c->chunk, c->rest) < 0 ? c : a;
+    }
+    if(chunk_compare(a, c->chunk, c->rest) < 0)
+        return a;
+    return chunk_compare(b, c->chunk, c->rest) < 0 ? c : b;
+}
+
+/* Sort keys whose first depth bytes are equal and whose chunks at
+   depth are loaded, with multikey quicksort: split them into the keys
+   whose chunk is smaller than, equal to or greater than the pivot,
+   and sort the equal ones by the next chunk. Each chunk of a common
+   prefix is loaded once, instead of once per comparison.
+
+   The two smaller parts are sorted recursively and the largest one
+   in the loop, so the recursion is at most log2(size) deep. */
+static void sort_object_keys(struct object_key *keys, size_t size,
+                             size_t depth)
+{
+    while(size > 1)
+    {
+        const struct object_key *median;
+        size_t lt, gt, i, equal, chunk, rest;
+        int cmp;
+
+        if(size < INSERTION_SORT_SIZE)
+        {
+            size_t j;
+
+            for(i = 1; i < size; i++)
+            {
+                for(j = i; j > 0; j--)
+                {
+                    if(object_key_compare(&keys[j - 1], &keys[j], depth) <= 0)
+                        break;
+                    object_key_swap(&keys[j - 1], &keys[j]);
+                }
+            }
+            return;
+        }
+
+        median = median_of_three(&keys[0], &keys[size / 2], &keys[size - 1]);
+        chunk = median->chunk;
+        rest = median->rest;
+
+        /* keys[0..lt) < pivot, keys[lt..i) == pivot and
+           keys[gt..size) > pivot */
+        lt = i = 0;
+        gt = size;
+        while(i < gt)
+        {
+            cmp = chunk_compare(&keys[i], chunk, rest);
+            if(cmp < 0)
+                object_key_swap(&keys[lt++], &keys[i++]);
+            else if(cmp > 0)
+                object_key_swap(&keys[i], &keys[--gt]);
+            else
+                i++;
+        }
+
+        /* Keys that end in this chunk are equal, and there's only one
+           of them as keys are unique */
+        equal = rest == CHUNK_SIZE ? gt - lt : 0;
+        if(equal)
+            load_chunks(keys + lt, equal, depth + CHUNK_SIZE);
+
+        if(lt >= equal && lt >= size - gt)
+        {
+            sort_object_keys(keys + lt, equal, depth + CHUNK_SIZE);
+            sort_object_keys(keys + gt, size - gt, depth);
+            size = lt;
+        }
+        else if(equal >= size - gt)
+        {
+            sort_object_keys(keys, lt, depth);
+            sort_object_keys(keys + gt, size - gt, depth);
+            keys += lt;
+            size = equal;
+            depth += CHUNK_SIZE;
+        }
+        else
+        {
+            sort_object_keys(keys, lt, depth);
+            sort_object_keys(keys + lt, equal, depth + CHUNK_SIZE);
+            keys += gt;
+            size -= gt;
+        }
+    }
 }
 
-static int object_key_compare_serials(const void *key1, const void *key2)
+/* Returns the iterators of the object's keys in sorted order. The
+   order is cached in the object until keys are added or removed. */
+static void **object_sorted_iters(json_t *json)
 {
-    size_t a = ((const struct object_key *)key1)->serial;
-    size_t b = ((const struct object_key *)key2)->serial;
+    json_object_t *object = json_to_object(json);
+    struct object_key *keys;
+    size_t size, i;
+    void *iter;
 
-    return a < b ? -1 : a == b ? 0 : 1;
+    if(object->sorted)
+        return object->sorted;
+
+    size = json_object_size(json);
+    keys = jsonp_malloc(size * sizeof(struct object_key));
+    if(!keys)
+        return NULL;
+
+    object->sorted = jsonp_arena_malloc(object->hashtable.arena,
+                                        size * sizeof(void *));
+    if(!object->sorted)
+    {
+        jsonp_free(keys);
+        return NULL;
+    }
+
+    i = 0;
+    for(iter = json_object_iter(json); iter;
+        iter = json_object_iter_next(json, iter))
+    {
+        keys[i].key = json_object_iter_key(iter);
+        keys[i].len = json_object_iter_key_len(iter);
+        keys[i].iter = iter;
+        i++;
+    }
+    assert(i == size);
+
+    load_chunks(keys, size, 0);
+    sort_object_keys(keys, size, 0);
+
+    for(i = 0; i < size; i++)
+        object->sorted[i] = keys[i].iter;
+
+    jsonp_free(keys);
+    return object->sorted;
 }
 
 static int do_dump(const json_t *json, size_t flags, int depth,
-                   json_dump_callback_t dump, void *data)
+                   dump_buffer_t *out)
 {
     if(!json)
         return -1;
 
     switch(json_typeof(json)) {
         case JSON_NULL:
-            return dump("null", 4, data);
+            return dump_write(out, "null", 4);
 
         case JSON_TRUE:
-            return dump("true", 4, data);
+            return dump_write(out, "true", 4);
 
         case JSON_FALSE:
-            return dump("false", 5, data);
+            return dump_write(out, "false", 5);
 
         case JSON_INTEGER:
         {
             char buffer[MAX_INTEGER_STR_LENGTH];
+            char *space;
             int size;
 
-            size = snprintf(buffer, MAX_INTEGER_STR_LENGTH,
-                            "%" JSON_INTEGER_FORMAT,
-                            json_integer_value(json));
-            if(size < 0 || size >= MAX_INTEGER_STR_LENGTH)
+            /* Format straight into the output buffer when possible */
+            if(dump_reserve(out, MAX_INTEGER_STR_LENGTH, &space))
                 return -1;
 
-            return dump(buffer, size, data);
+            size = jsonp_itostr(space ? space : buffer, MAX_INTEGER_STR_LENGTH,
+                                json_integer_value(json));
+            if(size < 0)
+                return -1;
+
+            if(!space)
+                return dump_write(out, buffer, size);
+
+            out->length += size;
+            return 0;
         }
 
         case JSON_REAL:
         {
             char buffer[MAX_REAL_STR_LENGTH];
+            char *space;
             int size;
             double value = json_real_value(json);
 
-            size = jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, value);
+            if(dump_reserve(out, MAX_REAL_STR_LENGTH, &space))
+                return -1;
+
+            size = jsonp_dtostr(space ? space : buffer, MAX_REAL_STR_LENGTH,
+                                value);
             if(size < 0)
                 return -1;
 
-            return dump(buffer, size, data);
+            if(!space)
+                return dump_write(out, buffer, size);
+
+            out->length += size;
+            return 0;
         }
 
         case JSON_STRING:
-            return dump_string(json_string_value(json), json_string_length(json), dump, data, flags);
+            return dump_string(json_string_value(json), json_string_length(json), out, flags);
 
         case JSON_ARRAY:
         {
@@ -232,35 +522,35 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 
             n = json_array_size(json);
 
-            if(dump("[", 1, data))
+            if(dump_write(out, "[", 1))
                 goto array_error;
             if(n == 0) {
                 array->visited = 0;
-                return dump("]", 1, data);
+                return dump_write(out, "]", 1);
             }
-            if(dump_indent(flags, depth + 1, 0, dump, data))
+            if(dump_indent(flags, depth + 1, 0, out))
                 goto array_error;
 
             for(i = 0; i < n; ++i) {
                 if(do_dump(json_array_get(json, i), flags, depth + 1,
-                           dump, data))
+                           out))
                     goto array_error;
 
                 if(i < n - 1)
                 {
-                    if(dump(",", 1, data) ||
-                       dump_indent(flags, depth + 1, 1, dump, data))
+                    if(dump_write(out, ",", 1) ||
+                       dump_indent(flags, depth + 1, 1, out))
                         goto array_error;
                 }
                 else
                 {
-                    if(dump_indent(flags, depth, 0, dump, data))
+                    if(dump_indent(flags, depth, 0, out))
                         goto array_error;
                 }
             }
 
             array->visited = 0;
-            return dump("]", 1, data);
+            return dump_write(out, "]", 1);
 
         array_error:
             array->visited = 0;
@@ -291,105 +581,75 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 
             iter = json_object_iter((json_t *)json);
 
-            if(dump("{", 1, data))
+            if(dump_write(out, "{", 1))
                 goto object_error;
             if(!iter) {
                 object->visited = 0;
-                return dump("}", 1, data);
+                return dump_write(out, "}", 1);
             }
-            if(dump_indent(flags, depth + 1, 0, dump, data))
+            if(dump_indent(flags, depth + 1, 0, out))
                 goto object_error;
 
-            if(flags & JSON_SORT_KEYS || flags & JSON_PRESERVE_ORDER)
+            if(flags & JSON_SORT_KEYS)
             {
-                struct object_key *keys;
+                void **sorted;
                 size_t size, i;
-                int (*cmp_func)(const void *, const void *);
 
-                size = json_object_size(json);
-                keys = jsonp_malloc(size * sizeof(struct object_key));
-                if(!keys)
+                sorted = object_sorted_iters((json_t *)json);
+                if(!sorted)
                     goto object_error;
 
-                i = 0;
-                while(iter)
-                {
-                    keys[i].serial = hashtable_iter_serial(iter);
-                    keys[i].key = json_object_iter_key(iter);
-                    iter = json_object_iter_next((json_t *)json, iter);
-                    i++;
-                }
-                assert(i == size);
-
-                if(flags & JSON_SORT_KEYS)
-                    cmp_func = object_key_compare_keys;
-                else
-                    cmp_func = object_key_compare_serials;
-
-                qsort(keys, size, sizeof(struct object_key), cmp_func);
-
+                size = json_object_size(json);
                 for(i = 0; i < size; i++)
                 {
-                    const char *key;
-                    json_t *value;
+                    iter = sorted[i];
 
-                    key = keys[i].key;
-                    value = json_object_get(json, key);
-                    assert(value);
-
-                    dump_string(key, strlen(key), dump, data, flags);
-                    if(dump(separator, separator_length, data) ||
-                       do_dump(value, flags, depth + 1, dump, data))
-                    {
-                        jsonp_free(keys);
+                    dump_string(json_object_iter_key(iter),
+                                json_object_iter_key_len(iter), out, flags);
+                    if(dump_write(out, separator, separator_length) ||
+                       do_dump(json_object_iter_value(iter), flags,
+                               depth + 1, out))
                         goto object_error;
-                    }
 
                     if(i < size - 1)
                     {
-                        if(dump(",", 1, data) ||
-                           dump_indent(flags, depth + 1, 1, dump, data))
-                        {
-                            jsonp_free(keys);
+                        if(dump_write(out, ",", 1) ||
+                           dump_indent(flags, depth + 1, 1, out))
                             goto object_error;
-                        }
                     }
                     else
                     {
-                        if(dump_indent(flags, depth, 0, dump, data))
-                        {
-                            jsonp_free(keys);
+                        if(dump_indent(flags, depth, 0, out))
                             goto object_error;
-                        }
                     }
                 }
-
-                jsonp_free(keys);
             }
             else
             {
-                /* Don't sort keys */
+                /* Objects are iterated in insertion order, so
+                   JSON_PRESERVE_ORDER needs no extra work */
 
                 while(iter)
                 {
                     void *next = json_object_iter_next((json_t *)json, iter);
                     const char *key = json_object_iter_key(iter);
+                    size_t len = json_object_iter_key_len(iter);
 
-                    dump_string(key, strlen(key), dump, data, flags);
-                    if(dump(separator, separator_length, data) ||
+                    dump_string(key, len, out, flags);
+                    if(dump_write(out, separator, separator_length) ||
                        do_dump(json_object_iter_value(iter), flags, depth + 1,
-                               dump, data))
+                               out))
                         goto object_error;
 
                     if(next)
                     {
-                        if(dump(",", 1, data) ||
-                           dump_indent(flags, depth + 1, 1, dump, data))
+                        if(dump_write(out, ",", 1) ||
+                           dump_indent(flags, depth + 1, 1, out))
                             goto object_error;
                     }
                     else
                     {
-                        if(dump_indent(flags, depth, 0, dump, data))
+                        if(dump_indent(flags, depth, 0, out))
                             goto object_error;
                     }
 
@@ -398,7 +658,7 @@ static int do_dump(const json_t *json, size_t flags, int depth,
             }
 
             object->visited = 0;
-            return dump("}", 1, data);
+            return dump_write(out, "}", 1);
 
         object_error:
             object->visited = 0;
@@ -412,20 +672,38 @@ static int do_dump(const json_t *json, size_t flags, int depth,
 }
 
 char *json_dumps(const json_t *json, size_t flags)
+{
+    return json_dumpsn(json, NULL, flags);
+}
+
+char *json_dumpsn(const json_t *json, size_t *size, size_t flags)
 {
     strbuffer_t strbuff;
-    char *result;
 
     if(strbuffer_init(&strbuff))
         return NULL;
 
-    if(json_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags))
-        result = NULL;
-    else
-        result = jsonp_strdup(strbuffer_value(&strbuff));
+    if(json_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags)) {
+        strbuffer_close(&strbuff);
+        return NULL;
+    }
 
-    strbuffer_close(&strbuff);
-    return result;
+    /* Hand the buffer over to the caller instead of copying it */
+    if(size)
+        *size = strbuff.length;
+    return jsonp_release(strbuffer_steal_value(&strbuff), strbuff.size,
+                         strbuff.length + 1);
+}
+
+size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags)
+{
+    struct buffer buf = { size, 0, buffer };
+
+    /* The caller's buffer is the output buffer, so write unbuffered */
+    if(json_dump_callback_ex(json, dump_to_buffer, (void *)&buf, flags, 0))
+        return 0;
+
+    return buf.used;
 }
 
 int json_dumpf(const json_t *json, FILE *output, size_t flags)
@@ -449,10 +727,38 @@ int json_dump_file(const json_t *json, const char *path, size_t flags)
 
 int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data, size_t flags)
 {
+    return json_dump_callback_ex(json, callback, data, flags, DUMP_BUFFER_SIZE);
+}
+
+int json_dump_callback_ex(const json_t *json, json_dump_callback_t callback, void *data, size_t flags, size_t bufsize)
+{
+    char stack_buffer[DUMP_BUFFER_SIZE];
+    dump_buffer_t out;
+    int result;
+
     if(!(flags & JSON_ENCODE_ANY)) {
         if(!json_is_array(json) && !json_is_object(json))
            return -1;
     }
 
-    return do_dump(json, flags, 0, callback, data);
+    out.size = bufsize;
+    out.length = 0;
+    out.callback = callback;
+    out.data = data;
+
+    if(bufsize <= DUMP_BUFFER_SIZE)
+        out.buffer = stack_buffer;
+    else {
+        out.buffer = jsonp_malloc(bufsize);
+        if(!out.buffer)
+            return -1;
+    }
+
+    result = do_dump(json, flags, 0, &out);
+    if(result == 0)
+        result = dump_flush(&out);
+
+    if(out.buffer != stack_buffer)
+        jsonp_free(out.buffer);
+    return result;
 }
@@ -22,15 +22,82 @@
 
 typedef struct hashtable_list list_t;
 typedef struct hashtable_pair pair_t;
-typedef struct hashtable_bucket bucket_t;
+typedef struct hashtable_node node_t;
 
 extern volatile uint32_t hashtable_seed;
 
 /* Implementation of the hash function */
+#ifdef USE_WYHASH
+#include "wyhash.h"
+#define hash_str(key, len)   ((size_t)wyhash((key), (len), hashtable_seed))
+#define hashsize(n)          ((size_t)1 << (n))
+#define hashmask(n)          (hashsize(n) - 1)
+#else
 #include "lookup3.h"
+#define hash_str(key, len)   ((size_t)hashlittle((key), (len), hashtable_seed))
+#endif
 
 #define list_to_pair(list_)  container_of(list_, pair_t, list)
-#define hash_str(key)        ((size_t)hashlittle((key), strlen(key), hashtable_seed))
+
+/* The memory of a hashtable comes from its arena, if it has one */
+#define ht_malloc(hashtable_, size_) \
+    jsonp_arena_malloc((hashtable_)->arena, (size_))
+#define ht_free(hashtable_, ptr_) \
+    jsonp_arena_free((hashtable_)->arena, (ptr_))
+
+/* Pairs are small, so they may come from a node pool */
+#define pair_size(key_len_)  (offsetof(pair_t, key) + (key_len_) + 1)
+#define pair_malloc(hashtable_, key_len_) \
+    jsonp_node_malloc((hashtable_)->arena, pair_size(key_len_))
+#define pair_free(hashtable_, pair_) \
+    jsonp_node_free((hashtable_)->arena, (pair_), pair_size((pair_)->key_len))
+
+/* Slot tags. An occupied slot has the high bit set and 7 bits of the
+   hash in the rest, so that most mismatches are found without
+   looking at the pair. */
+#define TAG_EMPTY       0x00
+#define TAG_DELETED     0x01
+#define hash_tag(hash)  ((unsigned char)(0x80 | (((uint32_t)(hash) >> 25) & 0x7f)))
+
+#define NOT_FOUND       ((size_t)-1)
+
+/* Hashtables with at most this many pairs have no index */
+#define SMALL_SIZE      8
+
+/* Order of the index built when a hashtable outgrows SMALL_SIZE */
+#define INITIAL_ORDER   4
+
+/* The index is rebuilt when more than 3/4 of the slots are in use */
+#define index_is_full(hashtable_) \
+    ((hashtable_)->used >= hashsize((hashtable_)->order) / 4 * 3)
+
+/* Indexes of at least pow(2, INCREMENTAL_ORDER) slots are rebuilt
+   incrementally, moving MIGRATE_STEP slots of the old index to the new
+   one on each hashtable_set() and hashtable_del(). The new index has
+   room for at least half of its size in new pairs, so it can't fill up
+   before the old one has been emptied. */
+#ifndef INCREMENTAL_ORDER
+#define INCREMENTAL_ORDER  12
+#endif
+#ifndef MIGRATE_STEP
+#define MIGRATE_STEP       64
+#endif
+
+/* A pair is placed at most PROBE_LIMIT slots from the start of its
+   probe sequence, and goes to the overflow tree if there's no free
+   slot that close. So a lookup walks at most PROBE_LIMIT slots and
+   then searches the tree, if there is one. With random keys, the tree
+   stays empty or nearly so.
+
+   These can be overridden at build time to exercise the incremental
+   rebuild and the overflow tree with small tables. */
+#ifndef PROBE_LIMIT
+#define PROBE_LIMIT     64
+#endif
+
+#define slot_is_used(tag_)  ((tag_) & 0x80)
+#define index_tags(slots_, order_) \
+    ((unsigned char *)((slots_) + hashsize(order_)))
 
 static JSON_INLINE void list_init(list_t *list)
 {
@@ -52,150 +119,608 @@ static JSON_INLINE void list_remove(list_t *list)
     list->next->prev = list->prev;
 }
 
-static JSON_INLINE int bucket_is_empty(hashtable_t *hashtable, bucket_t *bucket)
+static JSON_INLINE int pair_has_key(const pair_t *pair, const char *key,
+                                    size_t key_len, size_t hash)
+{
+    return pair->hash == hash && pair->key_len == key_len &&
+           memcmp(pair->key, key, key_len) == 0;
+}
+
+/* Order pairs by hash, then by key length and then by key */
+static int pair_compare(const pair_t *pair, const char *key,
+                        size_t key_len, size_t hash)
+{
+    if(pair->hash != hash)
+        return pair->hash < hash ? -1 : 1;
+    if(pair->key_len != key_len)
+        return pair->key_len < key_len ? -1 : 1;
+    return memcmp(pair->key, key, key_len);
+}
+
+static JSON_INLINE int node_height(const node_t *node)
+{
+    return node ? node->height : 0;
+}
+
+static JSON_INLINE void node_update(node_t *node)
 {
-    return bucket->first == &hashtable->list && bucket->first == bucket->last;
+    node->height = max(node_height(node->left), node_height(node->right)) + 1;
 }
 
-static void insert_to_bucket(hashtable_t *hashtable, bucket_t *bucket,
-                             list_t *list)
+static node_t *node_rotate_left(node_t *node)
 {
-    if(bucket_is_empty(hashtable, bucket))
+    node_t *right = node->right;
+
+    node->right = right->left;
+    right->left = node;
+    node_update(node);
+    node_update(right);
+    return right;
+}
+
+static node_t *node_rotate_right(node_t *node)
+{
+    node_t *left = node->left;
+
+    node->left = left->right;
+    left->right = node;
+    node_update(node);
+    node_update(left);
+    return left;
+}
+
+/* Restore the AVL balance of node after one of its subtrees has
+   changed height by one, and return the new root of the subtree */
+static node_t *node_balance(node_t *node)
+{
+    int balance = node_height(node->left) - node_height(node->right);
+
+    if(balance > 1)
+    {
+        if(node_height(node->left->left) < node_height(node->left->right))
+            node->left = node_rotate_left(node->left);
+        return node_rotate_right(node);
+    }
+    if(balance < -1)
     {
-        list_insert(&hashtable->list, list);
-        bucket->first = bucket->last = list;
+        if(node_height(node->right->right) < node_height(node->right->left))
+            node->right = node_rotate_right(node->right);
+        return node_rotate_left(node);
     }
+
+    node_update(node);
+    return node;
+}
+
+static node_t *tree_find(node_t *node, const char *key, size_t key_len,
+                         size_t hash)
+{
+    int cmp;
+
+    while(node)
+    {
+        cmp = pair_compare(node->pair, key, key_len, hash);
+        if(cmp == 0)
+            return node;
+        node = cmp > 0 ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+/* Insert a node whose key is not in the tree yet */
+static node_t *tree_insert(node_t *root, node_t *node)
+{
+    pair_t *pair = node->pair;
+
+    if(!root)
+    {
+        node->left = node->right = NULL;
+        node->height = 1;
+        return node;
+    }
+
+    if(pair_compare(root->pair, pair->key, pair->key_len, pair->hash) > 0)
+        root->left = tree_insert(root->left, node);
     else
+        root->right = tree_insert(root->right, node);
+
+    return node_balance(root);
+}
+
+/* Unlink the leftmost node of a subtree and store it in *min */
+static node_t *tree_remove_min(node_t *root, node_t **min)
+{
+    if(!root->left)
     {
-        list_insert(bucket->first, list);
-        bucket->first = list;
+        *min = root;
+        return root->right;
     }
+
+    root->left = tree_remove_min(root->left, min);
+    return node_balance(root);
 }
 
-static pair_t *hashtable_find_pair(hashtable_t *hashtable, bucket_t *bucket,
-                                   const char *key, size_t hash)
+/* Unlink the node of key and store it in *removed, or NULL if the key
+   is not in the tree */
+static node_t *tree_remove(node_t *root, const char *key, size_t key_len,
+                           size_t hash, node_t **removed)
 {
-    list_t *list;
-    pair_t *pair;
+    node_t *min;
+    int cmp;
 
-    if(bucket_is_empty(hashtable, bucket))
+    if(!root)
+    {
+        *removed = NULL;
         return NULL;
+    }
 
-    list = bucket->first;
-    while(1)
+    cmp = pair_compare(root->pair, key, key_len, hash);
+    if(cmp > 0)
+        root->left = tree_remove(root->left, key, key_len, hash, removed);
+    else if(cmp < 0)
+        root->right = tree_remove(root->right, key, key_len, hash, removed);
+    else
     {
-        pair = list_to_pair(list);
-        if(pair->hash == hash && strcmp(pair->key, key) == 0)
-            return pair;
+        *removed = root;
+        if(!root->left)
+            return root->right;
+        if(!root->right)
+            return root->left;
+
+        root->right = tree_remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = root->right;
+        return node_balance(min);
+    }
+
+    return node_balance(root);
+}
+
+static void tree_free(hashtable_t *hashtable, node_t *node)
+{
+    node_t *right;
+
+    /* Arena memory is freed all at once */
+    if(hashtable->arena)
+        return;
+
+    while(node)
+    {
+        tree_free(hashtable, node->left);
+        right = node->right;
+        ht_free(hashtable, node);
+        node = right;
+    }
+}
+
+/* Add pair to the overflow tree */
+static int hashtable_add_overflow(hashtable_t *hashtable, pair_t *pair)
+{
+    node_t *node = ht_malloc(hashtable, sizeof(node_t));
+    if(!node)
+        return -1;
+
+    node->pair = pair;
+    hashtable->overflow = tree_insert(hashtable->overflow, node);
+    return 0;
+}
+
+/* Returns the index of the slot holding key, or NOT_FOUND. If the key
+   is not found and free_index is not NULL, *free_index is set to the
+   slot where the key should be inserted, or to NOT_FOUND if there's no
+   free slot within PROBE_LIMIT slots. */
+static size_t index_find(pair_t **slots, const unsigned char *tags,
+                         size_t order, const char *key, size_t key_len,
+                         size_t hash, size_t *free_index)
+{
+    size_t mask = hashmask(order);
+    size_t index = hash & mask;
+    size_t deleted = NOT_FOUND;
+    unsigned char tag = hash_tag(hash);
+    size_t i;
+
+    for(i = 0; i < PROBE_LIMIT; i++)
+    {
+        unsigned char slot_tag = tags[index];
 
-        if(list == bucket->last)
+        if(slot_tag == tag)
+        {
+            if(pair_has_key(slots[index], key, key_len, hash))
+                return index;
+        }
+        else if(slot_tag == TAG_EMPTY)
+        {
+            if(deleted == NOT_FOUND)
+                deleted = index;
             break;
+        }
+        else if(slot_tag == TAG_DELETED && deleted == NOT_FOUND)
+            deleted = index;
 
-        list = list->next;
+        index = (index + 1) & mask;
     }
 
-    return NULL;
+    if(free_index)
+        *free_index = deleted;
+    return NOT_FOUND;
 }
 
-/* returns 0 on success, -1 if key was not found */
-static int hashtable_do_del(hashtable_t *hashtable,
-                            const char *key, size_t hash)
+/* Like index_find() without looking for a free slot, for lookups */
+static JSON_INLINE size_t index_lookup(pair_t **slots,
+                                       const unsigned char *tags,
+                                       size_t order, const char *key,
+                                       size_t key_len, size_t hash)
 {
-    pair_t *pair;
-    bucket_t *bucket;
-    size_t index;
+    size_t mask = hashmask(order);
+    size_t index = hash & mask;
+    unsigned char tag = hash_tag(hash);
+    size_t probes = PROBE_LIMIT;
 
-    index = hash & hashmask(hashtable->order);
-    bucket = &hashtable->buckets[index];
+    do
+    {
+        unsigned char slot_tag = tags[index];
 
-    pair = hashtable_find_pair(hashtable, bucket, key, hash);
-    if(!pair)
-        return -1;
+        if(slot_tag == tag)
+        {
+            if(pair_has_key(slots[index], key, key_len, hash))
+                return index;
+        }
+        else if(slot_tag == TAG_EMPTY)
+            break;
 
-    if(&pair->list == bucket->first && &pair->list == bucket->last)
-        bucket->first = bucket->last = &hashtable->list;
+        index = (index + 1) & mask;
+    } while(--probes);
 
-    else if(&pair->list == bucket->first)
-        bucket->first = pair->list.next;
+    return NOT_FOUND;
+}
 
-    else if(&pair->list == bucket->last)
-        bucket->last = pair->list.prev;
+/* Returns the first free slot within PROBE_LIMIT slots for a pair
+   that's not in the index, or NOT_FOUND */
+static size_t index_find_free(const unsigned char *tags, size_t order,
+                              size_t hash)
+{
+    size_t mask = hashmask(order);
+    size_t index = hash & mask;
+    size_t i;
 
-    list_remove(&pair->list);
-    json_decref(pair->value);
+    for(i = 0; i < PROBE_LIMIT; i++)
+    {
+        if(!slot_is_used(tags[index]))
+            return index;
+        index = (index + 1) & mask;
+    }
 
-    jsonp_free(pair);
-    hashtable->size--;
+    return NOT_FOUND;
+}
 
-    return 0;
+static JSON_INLINE size_t hashtable_find_slot(hashtable_t *hashtable,
+                                              const char *key, size_t key_len,
+                                              size_t hash, size_t *free_index)
+{
+    return index_find(hashtable->slots, hashtable->tags, hashtable->order,
+                      key, key_len, hash, free_index);
 }
 
-static void hashtable_do_clear(hashtable_t *hashtable)
+/* Look up key in the old index while it's being rebuilt */
+static JSON_INLINE size_t hashtable_find_old_slot(hashtable_t *hashtable,
+                                                  const char *key,
+                                                  size_t key_len, size_t hash)
 {
-    list_t *list, *next;
+    return index_lookup(hashtable->old_slots,
+                        index_tags(hashtable->old_slots, hashtable->old_order),
+                        hashtable->old_order, key, key_len, hash);
+}
+
+/* Linear search for small hashtables that have no index */
+static pair_t *hashtable_find_pair_small(hashtable_t *hashtable,
+                                         const char *key, size_t key_len,
+                                         size_t hash)
+{
+    list_t *list;
     pair_t *pair;
 
-    for(list = hashtable->list.next; list != &hashtable->list; list = next)
+    for(list = hashtable->list.next; list != &hashtable->list; list = list->next)
     {
-        next = list->next;
         pair = list_to_pair(list);
-        json_decref(pair->value);
-        jsonp_free(pair);
+        if(pair_has_key(pair, key, key_len, hash))
+            return pair;
     }
+
+    return NULL;
 }
 
-static int hashtable_do_rehash(hashtable_t *hashtable)
+static pair_t *hashtable_find_pair(hashtable_t *hashtable, const char *key,
+                                   size_t key_len, size_t hash)
 {
-    list_t *list, *next;
-    pair_t *pair;
-    size_t i, index, new_size;
+    size_t index;
+
+    if(!hashtable->slots)
+        return hashtable_find_pair_small(hashtable, key, key_len, hash);
 
-    jsonp_free(hashtable->buckets);
+    index = index_lookup(hashtable->slots, hashtable->tags, hashtable->order,
+                         key, key_len, hash);
+    if(index != NOT_FOUND)
+        return hashtable->slots[index];
 
-    hashtable->order++;
-    new_size = hashsize(hashtable->order);
+    if(hashtable->old_slots)
+    {
+        index = hashtable_find_old_slot(hashtable, key, key_len, hash);
+        if(index != NOT_FOUND)
+            return hashtable->old_slots[index];
+    }
 
-    hashtable->buckets = jsonp_malloc(new_size * sizeof(bucket_t));
-    if(!hashtable->buckets)
+    if(hashtable->overflow)
+    {
+        node_t *node = tree_find(hashtable->overflow, key, key_len, hash);
+        if(node)
+            return node->pair;
+    }
+
+    return NULL;
+}
+
+static void hashtable_clear_slot(hashtable_t *hashtable, size_t index)
+{
+    size_t next = (index + 1) & hashmask(hashtable->order);
+
+    /* No probe sequence goes past this slot if the next one is empty */
+    if(hashtable->tags[next] == TAG_EMPTY)
+    {
+        hashtable->tags[index] = TAG_EMPTY;
+        hashtable->used--;
+    }
+    else
+        hashtable->tags[index] = TAG_DELETED;
+}
+
+/* Allocate an empty index of pow(2, order) slots. The slots and their
+   tags share an allocation. */
+static pair_t **index_alloc(hashtable_t *hashtable, size_t order)
+{
+    pair_t **slots;
+    size_t size = hashsize(order);
+
+    slots = ht_malloc(hashtable, size * (sizeof(pair_t *) + 1));
+    if(!slots)
+        return NULL;
+
+    memset(index_tags(slots, order), TAG_EMPTY, size);
+    return slots;
+}
+
+/* Rebuild the index with pow(2, order) slots, dropping the deleted
+   slots. The overflow tree is rebuilt, too. */
+static int hashtable_do_rehash(hashtable_t *hashtable, size_t order)
+{
+    list_t *list;
+    pair_t **slots;
+    unsigned char *tags;
+    node_t *overflow = NULL, *node, *next;
+    size_t index, used = 0;
+
+    slots = index_alloc(hashtable, order);
+    if(!slots)
         return -1;
 
-    for(i = 0; i < hashsize(hashtable->order); i++)
+    tags = index_tags(slots, order);
+
+    for(list = hashtable->list.next; list != &hashtable->list; list = list->next)
     {
-        hashtable->buckets[i].first = hashtable->buckets[i].last =
-            &hashtable->list;
+        pair_t *pair = list_to_pair(list);
+
+        index = index_find_free(tags, order, pair->hash);
+        if(index == NOT_FOUND)
+        {
+            /* Collect the overflowing pairs in a list linked through
+               left, so that nothing has changed if this fails */
+            node = ht_malloc(hashtable, sizeof(node_t));
+            if(!node)
+            {
+                for(node = overflow; node; node = next)
+                {
+                    next = node->left;
+                    ht_free(hashtable, node);
+                }
+                ht_free(hashtable, slots);
+                return -1;
+            }
+            node->pair = pair;
+            node->left = overflow;
+            overflow = node;
+            continue;
+        }
+
+        tags[index] = hash_tag(pair->hash);
+        slots[index] = pair;
+        used++;
     }
 
-    list = hashtable->list.next;
-    list_init(&hashtable->list);
+    tree_free(hashtable, hashtable->overflow);
+    hashtable->overflow = NULL;
+    for(node = overflow; node; node = next)
+    {
+        next = node->left;
+        hashtable->overflow = tree_insert(hashtable->overflow, node);
+    }
 
-    for(; list != &hashtable->list; list = next) {
-        next = list->next;
-        pair = list_to_pair(list);
-        index = pair->hash % new_size;
-        insert_to_bucket(hashtable, &hashtable->buckets[index], &pair->list);
+    if(hashtable->slots)
+        ht_free(hashtable, hashtable->slots);
+
+    /* All pairs are in the list, so an incremental rebuild in progress
+       is superseded */
+    if(hashtable->old_slots)
+    {
+        ht_free(hashtable, hashtable->old_slots);
+        hashtable->old_slots = NULL;
     }
 
+    hashtable->slots = slots;
+    hashtable->tags = tags;
+    hashtable->order = order;
+    hashtable->used = used;
+
+    jsonp_count_rehash();
     return 0;
 }
 
+/* Start rebuilding the index with pow(2, order) slots. The current
+   index becomes the old one, to be emptied by hashtable_migrate(). */
+static int hashtable_start_rehash(hashtable_t *hashtable, size_t order)
+{
+    pair_t **slots;
 
-int hashtable_init(hashtable_t *hashtable)
+    slots = index_alloc(hashtable, order);
+    if(!slots)
+        return -1;
+
+    hashtable->old_slots = hashtable->slots;
+    hashtable->old_order = hashtable->order;
+    hashtable->migrated = 0;
+
+    hashtable->slots = slots;
+    hashtable->tags = index_tags(slots, order);
+    hashtable->order = order;
+    hashtable->used = 0;
+
+    jsonp_count_rehash();
+    return 0;
+}
+
+/* Move the pairs in the next count slots of the old index to the new
+   one, or to the overflow tree if they don't fit. The moved slots are
+   marked deleted rather than empty, so that lookups of the pairs still
+   in the old index keep working.
+
+   Returns -1 if out of memory. The pairs that weren't moved are left
+   in the old index, so the hashtable stays usable. */
+static int hashtable_migrate(hashtable_t *hashtable, size_t count)
 {
-    size_t i;
+    pair_t **old_slots = hashtable->old_slots;
+    unsigned char *old_tags = index_tags(old_slots, hashtable->old_order);
+    size_t old_size = hashsize(hashtable->old_order);
+    size_t i, end, index;
 
-    hashtable->size = 0;
-    hashtable->order = 3;
-    hashtable->buckets = jsonp_malloc(hashsize(hashtable->order) * sizeof(bucket_t));
-    if(!hashtable->buckets)
+    end = old_size;
+    if(old_size - hashtable->migrated > count)
+        end = hashtable->migrated + count;
+
+    for(i = hashtable->migrated; i < end; i++)
+    {
+        if(!slot_is_used(old_tags[i]))
+            continue;
+
+        /* The pair is not in the new index, so the first free slot
+           will do */
+        index = index_find_free(hashtable->tags, hashtable->order,
+                                old_slots[i]->hash);
+        if(index == NOT_FOUND)
+        {
+            if(hashtable_add_overflow(hashtable, old_slots[i]))
+            {
+                hashtable->migrated = i;
+                return -1;
+            }
+        }
+        else
+        {
+            if(hashtable->tags[index] == TAG_EMPTY)
+                hashtable->used++;
+            hashtable->tags[index] = old_tags[i];
+            hashtable->slots[index] = old_slots[i];
+        }
+        old_tags[i] = TAG_DELETED;
+    }
+
+    hashtable->migrated = end;
+    if(end == old_size)
+    {
+        ht_free(hashtable, old_slots);
+        hashtable->old_slots = NULL;
+    }
+
+    return 0;
+}
+
+/* Returns the order of the smallest index that holds size pairs
+   without growing */
+static size_t index_order_for(size_t size)
+{
+    size_t order = INITIAL_ORDER;
+
+    while(size > hashsize(order) / 4 * 3)
+        order++;
+
+    return order;
+}
+
+/* Drop the index of a hashtable that has become small enough to do
+   without one */
+static void hashtable_drop_index(hashtable_t *hashtable)
+{
+    if(hashtable->slots)
+        ht_free(hashtable, hashtable->slots);
+    if(hashtable->old_slots)
+        ht_free(hashtable, hashtable->old_slots);
+
+    tree_free(hashtable, hashtable->overflow);
+
+    hashtable->slots = NULL;
+    hashtable->tags = NULL;
+    hashtable->old_slots = NULL;
+    hashtable->overflow = NULL;
+    hashtable->order = 0;
+    hashtable->used = 0;
+}
+
+static int hashtable_grow(hashtable_t *hashtable)
+{
+    size_t order;
+
+    /* Not expected to happen, see INCREMENTAL_ORDER */
+    if(hashtable->old_slots &&
+       hashtable_migrate(hashtable, hashsize(hashtable->old_order)))
         return -1;
 
-    list_init(&hashtable->list);
+    /* Grow, unless enough of the used slots are deleted ones that
+       dropping them makes room */
+    order = hashtable->order;
+    if(hashtable->size >= hashsize(order) / 2)
+        order++;
 
-    for(i = 0; i < hashsize(hashtable->order); i++)
+    if(order < INCREMENTAL_ORDER)
+        return hashtable_do_rehash(hashtable, order);
+
+    return hashtable_start_rehash(hashtable, order);
+}
+
+static void hashtable_do_clear(hashtable_t *hashtable)
+{
+    list_t *list, *next;
+    pair_t *pair;
+
+    for(list = hashtable->list.next; list != &hashtable->list; list = next)
     {
-        hashtable->buckets[i].first = hashtable->buckets[i].last =
-            &hashtable->list;
+        next = list->next;
+        pair = list_to_pair(list);
+        json_decref(pair->value);
+        pair_free(hashtable, pair);
     }
+}
+
+
+int hashtable_init(hashtable_t *hashtable)
+{
+    /* The index is allocated when it's first needed */
+    hashtable->size = 0;
+    hashtable->used = 0;
+    hashtable->order = 0;
+    hashtable->slots = NULL;
+    hashtable->tags = NULL;
+    hashtable->old_slots = NULL;
+    hashtable->overflow = NULL;
+    hashtable->arena = NULL;
+    list_init(&hashtable->list);
 
     return 0;
 }
@@ -203,97 +728,289 @@ int hashtable_init(hashtable_t *hashtable)
 void hashtable_close(hashtable_t *hashtable)
 {
     hashtable_do_clear(hashtable);
-    jsonp_free(hashtable->buckets);
+    if(hashtable->slots)
+        ht_free(hashtable, hashtable->slots);
+    if(hashtable->old_slots)
+        ht_free(hashtable, hashtable->old_slots);
+    tree_free(hashtable, hashtable->overflow);
+}
+
+size_t hashtable_hash(const char *key, size_t key_len)
+{
+    return hash_str(key, key_len);
 }
 
 int hashtable_set(hashtable_t *hashtable,
-                  const char *key, size_t serial,
+                  const char *key, size_t key_len,
                   json_t *value)
 {
-    pair_t *pair;
-    bucket_t *bucket;
-    size_t hash, index;
+    return hashtable_set_hashed(hashtable, key, key_len,
+                                hash_str(key, key_len), value);
+}
 
-    /* rehash if the load ratio exceeds 1 */
-    if(hashtable->size >= hashsize(hashtable->order))
-        if(hashtable_do_rehash(hashtable))
-            return -1;
+int hashtable_set_hashed(hashtable_t *hashtable,
+                         const char *key, size_t key_len, size_t hash,
+                         json_t *value)
+{
+    pair_t *pair = NULL;
+    size_t index = 0, found;
+
+    if(!hashtable->slots)
+    {
+        pair = hashtable_find_pair_small(hashtable, key, key_len, hash);
+        if(!pair && hashtable->size >= SMALL_SIZE)
+        {
+            if(hashtable_do_rehash(hashtable, INITIAL_ORDER))
+                return -1;
+        }
+    }
+
+    if(hashtable->slots)
+    {
+        if(hashtable->old_slots)
+            hashtable_migrate(hashtable, MIGRATE_STEP);
+
+        found = hashtable_find_slot(hashtable, key, key_len, hash, &index);
+        if(found != NOT_FOUND)
+            pair = hashtable->slots[found];
+
+        else if(hashtable->old_slots)
+        {
+            found = hashtable_find_old_slot(hashtable, key, key_len, hash);
+            if(found != NOT_FOUND)
+                pair = hashtable->old_slots[found];
+        }
+
+        if(!pair && hashtable->overflow)
+        {
+            node_t *node = tree_find(hashtable->overflow, key, key_len, hash);
+            if(node)
+                pair = node->pair;
+        }
 
-    hash = hash_str(key);
-    index = hash & hashmask(hashtable->order);
-    bucket = &hashtable->buckets[index];
-    pair = hashtable_find_pair(hashtable, bucket, key, hash);
+        if(!pair && index != NOT_FOUND &&
+           hashtable->tags[index] == TAG_EMPTY && index_is_full(hashtable))
+        {
+            if(hashtable_grow(hashtable))
+                return -1;
+
+            hashtable_find_slot(hashtable, key, key_len, hash, &index);
+        }
+    }
 
     if(pair)
     {
         json_decref(pair->value);
         pair->value = value;
+        return 0;
     }
-    else
-    {
-        /* offsetof(...) returns the size of pair_t without the last,
-           flexible member. This way, the correct amount is
-           allocated. */
 
-        size_t len = strlen(key);
-        if(len >= (size_t)-1 - offsetof(pair_t, key)) {
-            /* Avoid an overflow if the key is very long */
-            return -1;
-        }
+    /* offsetof(...) returns the size of pair_t without the last,
+       flexible member. This way, the correct amount is
+       allocated. */
 
-        pair = jsonp_malloc(offsetof(pair_t, key) + len + 1);
-        if(!pair)
-            return -1;
+    if(key_len >= (size_t)-1 - offsetof(pair_t, key)) {
+        /* Avoid an overflow if the key is very long */
+        return -1;
+    }
 
-        pair->hash = hash;
-        pair->serial = serial;
-        strcpy(pair->key, key);
-        pair->value = value;
-        list_init(&pair->list);
+    pair = pair_malloc(hashtable, key_len);
+    if(!pair)
+        return -1;
 
-        insert_to_bucket(hashtable, bucket, &pair->list);
+    pair->hash = hash;
+    pair->key_len = key_len;
+    memcpy(pair->key, key, key_len);
+    pair->key[key_len] = '\0';
 
-        hashtable->size++;
+    if(hashtable->slots && index == NOT_FOUND)
+    {
+        if(hashtable_add_overflow(hashtable, pair))
+        {
+            pair_free(hashtable, pair);
+            return -1;
+        }
+    }
+    else if(hashtable->slots)
+    {
+        if(hashtable->tags[index] == TAG_EMPTY)
+            hashtable->used++;
+        hashtable->tags[index] = hash_tag(hash);
+        hashtable->slots[index] = pair;
     }
+
+    pair->value = value;
+    list_insert(&hashtable->list, &pair->list);
+    hashtable->size++;
+
     return 0;
 }
 
-void *hashtable_get(hashtable_t *hashtable, const char *key)
+void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len)
 {
-    pair_t *pair;
-    size_t hash;
-    bucket_t *bucket;
+    return hashtable_get_hashed(hashtable, key, key_len,
+                                hash_str(key, key_len));
+}
 
-    hash = hash_str(key);
-    bucket = &hashtable->buckets[hash & hashmask(hashtable->order)];
+void *hashtable_get_hashed(hashtable_t *hashtable,
+                           const char *key, size_t key_len, size_t hash)
+{
+    pair_t *pair;
 
-    pair = hashtable_find_pair(hashtable, bucket, key, hash);
+    pair = hashtable_find_pair(hashtable, key, key_len, hash);
     if(!pair)
         return NULL;
 
     return pair->value;
 }
 
-int hashtable_del(hashtable_t *hashtable, const char *key)
+int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len)
+{
+    pair_t *pair;
+    size_t hash, index;
+
+    hash = hash_str(key, key_len);
+
+    if(!hashtable->slots)
+    {
+        pair = hashtable_find_pair_small(hashtable, key, key_len, hash);
+        if(!pair)
+            return -1;
+    }
+    else
+    {
+        if(hashtable->old_slots)
+            hashtable_migrate(hashtable, MIGRATE_STEP);
+
+        index = hashtable_find_slot(hashtable, key, key_len, hash, NULL);
+        if(index != NOT_FOUND)
+        {
+            pair = hashtable->slots[index];
+            hashtable_clear_slot(hashtable, index);
+        }
+        else if(hashtable->old_slots &&
+                (index = hashtable_find_old_slot(hashtable, key, key_len, hash)) != NOT_FOUND)
+        {
+            pair = hashtable->old_slots[index];
+            index_tags(hashtable->old_slots, hashtable->old_order)[index] = TAG_DELETED;
+        }
+        else
+        {
+            node_t *node;
+
+            hashtable->overflow = tree_remove(hashtable->overflow, key,
+                                              key_len, hash, &node);
+            if(!node)
+                return -1;
+
+            pair = node->pair;
+            ht_free(hashtable, node);
+        }
+    }
+
+    list_remove(&pair->list);
+    json_decref(pair->value);
+
+    pair_free(hashtable, pair);
+    hashtable->size--;
+
+    return 0;
+}
+
+int hashtable_reserve(hashtable_t *hashtable, size_t size)
 {
-    size_t hash = hash_str(key);
-    return hashtable_do_del(hashtable, key, hash);
+    size_t order;
+
+    if(size <= SMALL_SIZE)
+        return 0;
+
+    /* Avoid an overflow in the index size */
+    if(size > (size_t)-1 / 4 / (sizeof(pair_t *) + 1))
+        return -1;
+
+    order = index_order_for(size);
+    if(hashtable->slots && hashtable->order >= order)
+        return 0;
+
+    return hashtable_do_rehash(hashtable, order);
 }
 
-void hashtable_clear(hashtable_t *hashtable)
+int hashtable_shrink(hashtable_t *hashtable)
 {
-    size_t i;
+    size_t order;
 
+    if(hashtable->size <= SMALL_SIZE)
+    {
+        hashtable_drop_index(hashtable);
+        return 0;
+    }
+
+    order = index_order_for(hashtable->size);
+    if(order == hashtable->order && !hashtable->old_slots &&
+       hashtable->used == hashtable->size)
+        return 0;
+
+    return hashtable_do_rehash(hashtable, order);
+}
+
+void hashtable_clear(hashtable_t *hashtable)
+{
     hashtable_do_clear(hashtable);
 
-    for(i = 0; i < hashsize(hashtable->order); i++)
+    /* Keep the index, the hashtable is likely to be filled again */
+    if(hashtable->slots)
+        memset(hashtable->tags, TAG_EMPTY, hashsize(hashtable->order));
+
+    tree_free(hashtable, hashtable->overflow);
+    hashtable->overflow = NULL;
+
+    if(hashtable->old_slots)
     {
-        hashtable->buckets[i].first = hashtable->buckets[i].last =
-            &hashtable->list;
+        ht_free(hashtable, hashtable->old_slots);
+        hashtable->old_slots = NULL;
     }
 
     list_init(&hashtable->list);
     hashtable->size = 0;
+    hashtable->used = 0;
+}
+
+static size_t tree_size(const node_t *node)
+{
+    size_t size = 0;
+
+    while(node)
+    {
+        size += 1 + tree_size(node->left);
+        node = node->right;
+    }
+    return size;
+}
+
+size_t hashtable_index_usage(const hashtable_t *hashtable)
+{
+    size_t usage = 0;
+
+    if(hashtable->slots)
+        usage += hashsize(hashtable->order) * (sizeof(pair_t *) + 1);
+    if(hashtable->old_slots)
+        usage += hashsize(hashtable->old_order) * (sizeof(pair_t *) + 1);
+
+    return usage;
+}
+
+size_t hashtable_memory_usage(const hashtable_t *hashtable)
+{
+    const list_t *list;
+    size_t usage;
+
+    usage = hashtable_index_usage(hashtable);
+    usage += tree_size(hashtable->overflow) * sizeof(node_t);
+
+    for(list = hashtable->list.next; list != &hashtable->list; list = list->next)
+        usage += pair_size(list_to_pair(list)->key_len);
+
+    return usage;
 }
 
 void *hashtable_iter(hashtable_t *hashtable)
@@ -301,16 +1018,13 @@ void *hashtable_iter(hashtable_t *hashtable)
     return hashtable_iter_next(hashtable, &hashtable->list);
 }
 
-void *hashtable_iter_at(hashtable_t *hashtable, const char *key)
+void *hashtable_iter_at(hashtable_t *hashtable, const char *key,
+                        size_t key_len)
 {
     pair_t *pair;
-    size_t hash;
-    bucket_t *bucket;
-
-    hash = hash_str(key);
-    bucket = &hashtable->buckets[hash & hashmask(hashtable->order)];
 
-    pair = hashtable_find_pair(hashtable, bucket, key, hash);
+    pair = hashtable_find_pair(hashtable, key, key_len,
+                               hash_str(key, key_len));
     if(!pair)
         return NULL;
 
@@ -331,10 +1045,10 @@ void *hashtable_iter_key(void *iter)
     return pair->key;
 }
 
-size_t hashtable_iter_serial(void *iter)
+size_t hashtable_iter_key_len(void *iter)
 {
     pair_t *pair = list_to_pair((list_t *)iter);
-    return pair->serial;
+    return pair->key_len;
 }
 
 void *hashtable_iter_value(void *iter)
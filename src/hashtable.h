@@ -17,22 +17,53 @@ struct hashtable_list {
    key-value pair. In this case, it just encodes some extra data,
    too */
 struct hashtable_pair {
-    size_t hash;
     struct hashtable_list list;
+    size_t hash;
     json_t *value;
-    size_t serial;
+    size_t key_len;
     char key[1];
 };
 
-struct hashtable_bucket {
-    struct hashtable_list *first;
-    struct hashtable_list *last;
+/* A node of the overflow tree, an AVL tree ordered by hash and key */
+struct hashtable_node {
+    struct hashtable_node *left;
+    struct hashtable_node *right;
+    struct hashtable_pair *pair;
+    int height;
 };
 
+/* The pairs are linked to a list in insertion order that is used for
+   iteration. Lookups go through an open addressing index: slots[]
+   points to the pairs and tags[] holds a byte per slot, derived from
+   the hash of the key or telling that the slot is empty or deleted. A
+   lookup walks tags[] with linear probing and only touches the pairs
+   whose tag matches.
+
+   Small hashtables have no index (slots is NULL) and are searched by
+   walking the list. The index is built when they grow past 8 pairs.
+
+   A pair is never placed more than a fixed number of slots from where
+   its probe sequence starts. Pairs that don't fit, because too many
+   keys hash close to each other, are kept in the overflow tree
+   instead. This bounds the cost of a lookup even when the keys are
+   chosen to collide.
+
+   Large indexes are rebuilt incrementally. Until all pairs have moved
+   over, lookups check both the new index and old_slots.
+
+   If arena is set after hashtable_init(), all memory comes from the
+   arena and is never freed individually. */
 typedef struct hashtable {
-    size_t size;
-    struct hashtable_bucket *buckets;
-    size_t order;  /* hashtable has pow(2, order) buckets */
+    size_t size;   /* number of pairs */
+    size_t used;   /* number of non-empty slots, including deleted */
+    size_t order;  /* index has pow(2, order) slots */
+    struct hashtable_pair **slots;
+    unsigned char *tags;
+    struct hashtable_pair **old_slots;  /* non-NULL while rebuilding */
+    size_t old_order;
+    size_t migrated;  /* slots of the old index moved so far */
+    struct hashtable_node *overflow;
+    json_arena_t *arena;  /* where memory is allocated, or NULL */
     struct hashtable_list list;
 } hashtable_t;
 
@@ -62,12 +93,23 @@ int hashtable_init(hashtable_t *hashtable);
  */
 void hashtable_close(hashtable_t *hashtable);
 
+/**
+ * hashtable_hash - Compute the hash of a key
+ *
+ * @key: The key
+ * @key_len: The length of key
+ *
+ * Returns the hash the hashtable uses for key. It can be passed to
+ * the *_hashed functions to avoid hashing the same key repeatedly.
+ */
+size_t hashtable_hash(const char *key, size_t key_len);
+
 /**
  * hashtable_set - Add/modify value in hashtable
  *
  * @hashtable: The hashtable object
  * @key: The key
- * @serial: For addition order of keys
+ * @key_len: The length of key
  * @value: The value
  *
  * If a value with the given key already exists, its value is replaced
@@ -78,28 +120,51 @@ void hashtable_close(hashtable_t *hashtable);
  * Returns 0 on success, -1 on failure (out of memory).
  */
 int hashtable_set(hashtable_t *hashtable,
-                  const char *key, size_t serial,
+                  const char *key, size_t key_len,
                   json_t *value);
 
+/**
+ * hashtable_set_hashed - Add/modify value in hashtable
+ *
+ * @hash: The hash of key, as returned by hashtable_hash()
+ *
+ * Like hashtable_set() but doesn't hash the key.
+ */
+int hashtable_set_hashed(hashtable_t *hashtable,
+                         const char *key, size_t key_len, size_t hash,
+                         json_t *value);
+
 /**
  * hashtable_get - Get a value associated with a key
  *
  * @hashtable: The hashtable object
  * @key: The key
+ * @key_len: The length of key
  *
  * Returns value if it is found, or NULL otherwise.
  */
-void *hashtable_get(hashtable_t *hashtable, const char *key);
+void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len);
+
+/**
+ * hashtable_get_hashed - Get a value associated with a key
+ *
+ * @hash: The hash of key, as returned by hashtable_hash()
+ *
+ * Like hashtable_get() but doesn't hash the key.
+ */
+void *hashtable_get_hashed(hashtable_t *hashtable,
+                           const char *key, size_t key_len, size_t hash);
 
 /**
  * hashtable_del - Remove a value from the hashtable
  *
  * @hashtable: The hashtable object
  * @key: The key
+ * @key_len: The length of key
  *
  * Returns 0 on success, or -1 if the key was not found.
  */
-int hashtable_del(hashtable_t *hashtable, const char *key);
+int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len);
 
 /**
  * hashtable_clear - Clear hashtable
@@ -110,6 +175,53 @@ int hashtable_del(hashtable_t *hashtable, const char *key);
  */
 void hashtable_clear(hashtable_t *hashtable);
 
+/**
+ * hashtable_reserve - Make room for pairs
+ *
+ * @hashtable: The hashtable object
+ * @size: The number of pairs
+ *
+ * Builds an index large enough to hold size pairs without being
+ * rebuilt. Does nothing if the index is already large enough.
+ *
+ * Returns 0 on success, -1 on failure (out of memory).
+ */
+int hashtable_reserve(hashtable_t *hashtable, size_t size);
+
+/**
+ * hashtable_shrink - Release unused memory
+ *
+ * @hashtable: The hashtable object
+ *
+ * Rebuilds the index to the smallest size that holds the current
+ * pairs, or drops it if the hashtable is small enough to do without.
+ *
+ * Returns 0 on success, -1 on failure (out of memory).
+ */
+int hashtable_shrink(hashtable_t *hashtable);
+
+/**
+ * hashtable_index_usage - Count the memory held by the index
+ *
+ * @hashtable: The hashtable object
+ *
+ * Returns the number of bytes allocated for the index, including the
+ * old index while it's being rebuilt. Unlike
+ * hashtable_memory_usage(), this runs in constant time.
+ */
+size_t hashtable_index_usage(const hashtable_t *hashtable);
+
+/**
+ * hashtable_memory_usage - Count the memory held by a hashtable
+ *
+ * @hashtable: The hashtable object
+ *
+ * Returns the number of bytes allocated for the index, the overflow
+ * tree and the pairs, including their keys. The hashtable_t itself
+ * and the values are not included.
+ */
+size_t hashtable_memory_usage(const hashtable_t *hashtable);
+
 /**
  * hashtable_iter - Iterate over hashtable
  *
@@ -117,7 +229,7 @@ void hashtable_clear(hashtable_t *hashtable);
  *
  * Returns an opaque iterator to the first element in the hashtable.
  * The iterator should be passed to hashtable_iter_* functions.
- * The hashtable items are not iterated over in any particular order.
+ * The items are iterated over in the order they were added in.
  *
  * There's no need to free the iterator in any way. The iterator is
  * valid as long as the item that is referenced by the iterator is not
@@ -132,11 +244,13 @@ void *hashtable_iter(hashtable_t *hashtable);
  *
  * @hashtable: The hashtable object
  * @key: The key that the iterator should point to
+ * @key_len: The length of key
  *
  * Like hashtable_iter() but returns an iterator pointing to a
  * specific key.
  */
-void *hashtable_iter_at(hashtable_t *hashtable, const char *key);
+void *hashtable_iter_at(hashtable_t *hashtable, const char *key,
+                        size_t key_len);
 
 /**
  * hashtable_iter_next - Advance an iterator
@@ -157,11 +271,11 @@ void *hashtable_iter_next(hashtable_t *hashtable, void *iter);
 void *hashtable_iter_key(void *iter);
 
 /**
- * hashtable_iter_serial - Retrieve the serial number pointed to by an iterator
+ * hashtable_iter_key_len - Retrieve the length of the key pointed by an iterator
  *
  * @iter: The iterator
  */
-size_t hashtable_iter_serial(void *iter);
+size_t hashtable_iter_key_len(void *iter);
 
 /**
  * hashtable_iter_value - Retrieve the value pointed by an iterator
@@ -52,6 +52,12 @@ typedef struct json_t {
     size_t refcount;
 } json_t;
 
+/* Precomputed object key, see json_key_make() */
+typedef struct json_key_t json_key_t;
+
+/* Memory arena for values that are freed together */
+typedef struct json_arena_t json_arena_t;
+
 #ifndef JANSSON_USING_CMAKE /* disabled if using cmake */
 #if JSON_INTEGER_IS_LONG_LONG
 #ifdef _WIN32
@@ -82,7 +88,9 @@ typedef long json_int_t;
 /* construction, destruction, reference counting */
 
 json_t *json_object(void);
+json_t *json_object_sized(size_t size);
 json_t *json_array(void);
+json_t *json_array_sized(size_t size);
 json_t *json_string(const char *value);
 json_t *json_stringn(const char *value, size_t len);
 json_t *json_string_nocheck(const char *value);
@@ -113,6 +121,19 @@ void json_decref(json_t *json)
 }
 
 
+/* arenas */
+
+json_arena_t *json_arena_create(void);
+void json_arena_destroy(json_arena_t *arena);
+
+json_t *json_arena_object(json_arena_t *arena);
+json_t *json_arena_array(json_arena_t *arena);
+json_t *json_arena_string(json_arena_t *arena, const char *value);
+json_t *json_arena_stringn(json_arena_t *arena, const char *value, size_t len);
+json_t *json_arena_integer(json_arena_t *arena, json_int_t value);
+json_t *json_arena_real(json_arena_t *arena, double value);
+
+
 /* error reporting */
 
 #define JSON_ERROR_TEXT_LENGTH    160
@@ -132,10 +153,16 @@ typedef struct {
 void json_object_seed(size_t seed);
 size_t json_object_size(const json_t *object);
 json_t *json_object_get(const json_t *object, const char *key);
+json_t *json_object_getn(const json_t *object, const char *key, size_t key_len);
 int json_object_set_new(json_t *object, const char *key, json_t *value);
+int json_object_setn_new(json_t *object, const char *key, size_t key_len, json_t *value);
 int json_object_set_new_nocheck(json_t *object, const char *key, json_t *value);
+int json_object_setn_new_nocheck(json_t *object, const char *key, size_t key_len, json_t *value);
 int json_object_del(json_t *object, const char *key);
+int json_object_deln(json_t *object, const char *key, size_t key_len);
 int json_object_clear(json_t *object);
+int json_object_reserve(json_t *object, size_t size);
+int json_object_shrink(json_t *object);
 int json_object_update(json_t *object, json_t *other);
 int json_object_update_existing(json_t *object, json_t *other);
 int json_object_update_missing(json_t *object, json_t *other);
@@ -144,14 +171,27 @@ void *json_object_iter_at(json_t *object, const char *key);
 void *json_object_key_to_iter(const char *key);
 void *json_object_iter_next(json_t *object, void *iter);
 const char *json_object_iter_key(void *iter);
+size_t json_object_iter_key_len(void *iter);
 json_t *json_object_iter_value(void *iter);
 int json_object_iter_set_new(json_t *object, void *iter, json_t *value);
 
+json_key_t *json_key_make(const char *key);
+json_key_t *json_key_maken(const char *key, size_t key_len);
+void json_key_free(json_key_t *key);
+json_t *json_object_get_by_key(const json_t *object, const json_key_t *key);
+
 #define json_object_foreach(object, key, value) \
     for(key = json_object_iter_key(json_object_iter(object)); \
         key && (value = json_object_iter_value(json_object_key_to_iter(key))); \
         key = json_object_iter_key(json_object_iter_next(object, json_object_key_to_iter(key))))
 
+#define json_object_keylen_foreach(object, key, key_len, value) \
+    for(key = json_object_iter_key(json_object_iter(object)), \
+            key_len = json_object_iter_key_len(json_object_key_to_iter(key)); \
+        key && (value = json_object_iter_value(json_object_key_to_iter(key))); \
+        key = json_object_iter_key(json_object_iter_next(object, json_object_key_to_iter(key))), \
+            key_len = json_object_iter_key_len(json_object_key_to_iter(key)))
+
 #define json_array_foreach(array, index, value) \
 	for(index = 0; \
 		index < json_array_size(array) && (value = json_array_get(array, index)); \
@@ -169,6 +209,18 @@ int json_object_set_nocheck(json_t *object, const char *key, json_t *value)
     return json_object_set_new_nocheck(object, key, json_incref(value));
 }
 
+static JSON_INLINE
+int json_object_setn(json_t *object, const char *key, size_t key_len, json_t *value)
+{
+    return json_object_setn_new(object, key, key_len, json_incref(value));
+}
+
+static JSON_INLINE
+int json_object_setn_nocheck(json_t *object, const char *key, size_t key_len, json_t *value)
+{
+    return json_object_setn_new_nocheck(object, key, key_len, json_incref(value));
+}
+
 static JSON_INLINE
 int json_object_iter_set(json_t *object, void *iter, json_t *value)
 {
@@ -182,6 +234,8 @@ int json_array_append_new(json_t *array, json_t *value);
 int json_array_insert_new(json_t *array, size_t index, json_t *value);
 int json_array_remove(json_t *array, size_t index);
 int json_array_clear(json_t *array);
+int json_array_reserve(json_t *array, size_t size);
+int json_array_shrink(json_t *array);
 int json_array_extend(json_t *array, json_t *other);
 
 static JSON_INLINE
@@ -256,6 +310,30 @@ json_t *json_loadf(FILE *input, size_t flags, json_error_t *error);
 json_t *json_load_file(const char *path, size_t flags, json_error_t *error);
 json_t *json_load_callback(json_load_callback_t callback, void *data, size_t flags, json_error_t *error);
 
+json_t *json_loads_arena(json_arena_t *arena, const char *input, size_t flags, json_error_t *error);
+json_t *json_loadb_arena(json_arena_t *arena, const char *buffer, size_t buflen, size_t flags, json_error_t *error);
+json_t *json_loadf_arena(json_arena_t *arena, FILE *input, size_t flags, json_error_t *error);
+json_t *json_load_file_arena(json_arena_t *arena, const char *path, size_t flags, json_error_t *error);
+json_t *json_load_callback_arena(json_arena_t *arena, json_load_callback_t callback, void *data, size_t flags, json_error_t *error);
+
+/* the default nesting limit of arrays and objects */
+#define JSON_PARSER_MAX_DEPTH   2048
+
+/* zero means the default: JSON_PARSER_MAX_DEPTH for max_depth, no
+   limit for the rest */
+typedef struct {
+    size_t max_depth;
+    size_t max_bytes;
+    size_t max_string;
+    size_t max_elements;
+} json_load_limits_t;
+
+json_t *json_loads_ex(json_arena_t *arena, const char *input, size_t flags, const json_load_limits_t *limits, json_error_t *error);
+json_t *json_loadb_ex(json_arena_t *arena, const char *buffer, size_t buflen, size_t flags, const json_load_limits_t *limits, json_error_t *error);
+json_t *json_loadf_ex(json_arena_t *arena, FILE *input, size_t flags, const json_load_limits_t *limits, json_error_t *error);
+json_t *json_load_file_ex(json_arena_t *arena, const char *path, size_t flags, const json_load_limits_t *limits, json_error_t *error);
+json_t *json_load_callback_ex(json_arena_t *arena, json_load_callback_t callback, void *data, size_t flags, const json_load_limits_t *limits, json_error_t *error);
+
 
 /* encoding */
 
@@ -270,9 +348,12 @@ json_t *json_load_callback(json_load_callback_t callback, void *data, size_t fla
 typedef int (*json_dump_callback_t)(const char *buffer, size_t size, void *data);
 
 char *json_dumps(const json_t *json, size_t flags);
+char *json_dumpsn(const json_t *json, size_t *size, size_t flags);
+size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags);
 int json_dumpf(const json_t *json, FILE *output, size_t flags);
 int json_dump_file(const json_t *json, const char *path, size_t flags);
 int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data, size_t flags);
+int json_dump_callback_ex(const json_t *json, json_dump_callback_t callback, void *data, size_t flags, size_t bufsize);
 
 /* custom memory allocation */
 
@@ -281,6 +362,26 @@ typedef void (*json_free_t)(void *);
 
 void json_set_alloc_funcs(json_malloc_t malloc_fn, json_free_t free_fn);
 
+typedef void *(*json_malloc_ex_t)(size_t size, void *ctx);
+typedef void *(*json_realloc_ex_t)(void *ptr, size_t size, void *ctx);
+typedef void (*json_free_ex_t)(void *ptr, void *ctx);
+
+void json_set_alloc_funcs_ex(json_malloc_ex_t malloc_fn, json_realloc_ex_t realloc_fn, json_free_ex_t free_fn, void *ctx);
+void json_pool_release(void);
+
+/* memory accounting */
+
+typedef struct {
+    size_t allocs;
+    size_t frees;
+    size_t bytes;
+    size_t rehashes;
+    size_t array_grows;
+} json_memory_stats_t;
+
+size_t json_memory_usage(const json_t *json);
+int json_memory_stats(json_memory_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
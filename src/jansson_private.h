@@ -8,6 +8,7 @@
 #ifndef JANSSON_PRIVATE_H
 #define JANSSON_PRIVATE_H
 
+#include <limits.h>
 #include <stddef.h>
 #include "jansson.h"
 #include "hashtable.h"
@@ -21,6 +22,12 @@
 #define max(a, b)  ((a) > (b) ? (a) : (b))
 #endif
 
+/* json_int_t may be any signed integer type, so compute its range
+   from its size */
+#define JSON_INTEGER_MAX \
+    ((((json_int_t)1 << (sizeof(json_int_t) * CHAR_BIT - 2)) - 1) * 2 + 1)
+#define JSON_INTEGER_MIN  (-JSON_INTEGER_MAX - 1)
+
 /* va_copy is a C99 feature. In C89 implementations, it's sometimes
    available as __va_copy. If not, memcpy() should do the trick. */
 #ifndef va_copy
@@ -34,7 +41,7 @@
 typedef struct {
     json_t json;
     hashtable_t hashtable;
-    size_t serial;
+    void **sorted;  /* iterators in sorted key order, or NULL */
     int visited;
 } json_object_t;
 
@@ -43,6 +50,7 @@ typedef struct {
     size_t size;
     size_t entries;
     json_t **table;
+    json_arena_t *arena;  /* where table is allocated, or NULL */
     int visited;
 } json_array_t;
 
@@ -62,14 +70,25 @@ typedef struct {
     json_int_t value;
 } json_integer_t;
 
+/* A key with its hash computed in advance */
+struct json_key_t {
+    size_t hash;
+    size_t len;
+    char key[1];
+};
+
 #define json_to_object(json_)  container_of(json_, json_object_t, json)
 #define json_to_array(json_)   container_of(json_, json_array_t, json)
 #define json_to_string(json_)  container_of(json_, json_string_t, json)
 #define json_to_real(json_)    container_of(json_, json_real_t, json)
 #define json_to_integer(json_) container_of(json_, json_integer_t, json)
 
+/* Table size of a new array, unless another size is asked for */
+#define ARRAY_INITIAL_SIZE  8
+
 /* Create a string by taking ownership of an existing buffer */
-json_t *jsonp_stringn_nocheck_own(const char *value, size_t len);
+json_t *jsonp_stringn_nocheck_own(json_arena_t *arena, const char *value,
+                                  size_t len);
 
 /* Error message formatting */
 void jsonp_error_init(json_error_t *error, const char *source);
@@ -79,17 +98,44 @@ void jsonp_error_set(json_error_t *error, int line, int column,
 void jsonp_error_vset(json_error_t *error, int line, int column,
                       size_t position, const char *msg, va_list ap);
 
-/* Locale independent string<->double conversions */
+/* Locale independent string<->number conversions */
 int jsonp_strtod(strbuffer_t *strbuffer, double *out);
 int jsonp_dtostr(char *buffer, size_t size, double value);
+int jsonp_itostr(char *buffer, size_t size, json_int_t value);
 
 /* Wrappers for custom memory functions */
 void* jsonp_malloc(size_t size);
 void jsonp_free(void *ptr);
+/* Like realloc(), but old_size must be the size of the block at ptr.
+   On failure, ptr is left untouched. */
+void *jsonp_realloc(void *ptr, size_t old_size, size_t size);
+/* Hand a block of size bytes, of which the first used bytes are in
+   use, over to the user, who frees it with the configured free
+   function. Returns the pointer to give to the user. */
+void *jsonp_release(void *ptr, size_t size, size_t used);
 char *jsonp_strndup(const char *str, size_t length);
 char *jsonp_strdup(const char *str);
 char *jsonp_strndup(const char *str, size_t len);
 
+/* Allocate from arena, or with jsonp_malloc() if arena is NULL.
+   jsonp_arena_free() does nothing for arena memory. */
+void *jsonp_arena_malloc(json_arena_t *arena, size_t size);
+void *jsonp_arena_realloc(json_arena_t *arena, void *ptr, size_t old_size,
+                          size_t size);
+void jsonp_arena_free(json_arena_t *arena, void *ptr);
+
+/* Like jsonp_arena_malloc() and jsonp_arena_free(), but small blocks
+   may be recycled through per-thread pools when the library is built
+   with USE_NODE_POOLS. The size passed to jsonp_node_free() must be
+   the one the block was allocated with. */
+void *jsonp_node_malloc(json_arena_t *arena, size_t size);
+void jsonp_node_free(json_arena_t *arena, void *ptr, size_t size);
+
+/* Memory statistics, counted if the library is built with
+   USE_MEMORY_STATS */
+void jsonp_count_rehash(void);
+void jsonp_count_array_grow(void);
+
 /* Windows compatibility */
 #ifdef _WIN32
 #define snprintf _snprintf
@@ -18,6 +18,7 @@
 
 #include "jansson.h"
 #include "jansson_private.h"
+#include "scan.h"
 #include "strbuffer.h"
 #include "utf.h"
 
@@ -25,6 +26,9 @@
 #define STREAM_STATE_EOF      -1
 #define STREAM_STATE_ERROR    -2
 
+/* Number of bytes of in-memory input validated as UTF-8 at a time */
+#define STREAM_VALIDATE_CHUNK  4096
+
 #define TOKEN_INVALID         -1
 #define TOKEN_EOF              0
 #define TOKEN_STRING         256
@@ -52,6 +56,15 @@ typedef struct {
     void *data;
     char buffer[5];
     size_t buffer_pos;
+
+    /* If the whole input is in memory, get is NULL and the input is
+       read directly from [pos, end). The input is validated as UTF-8
+       a chunk at a time; bytes in [pos, valid_end) are known to be
+       valid. */
+    const char *pos;
+    const char *end;
+    const char *valid_end;
+
     int state;
     int line;
     int column, last_column;
@@ -70,6 +83,12 @@ typedef struct {
         json_int_t integer;
         double real;
     } value;
+    json_arena_t *arena;  /* where values are allocated, or NULL */
+    json_load_limits_t limits;  /* with zeros replaced by defaults */
+    size_t max_source;  /* source length of the longest allowed string */
+    size_t max_text;    /* longest token text the limits still allow */
+    size_t depth;       /* nesting of the current value */
+    size_t bytes;       /* memory held by the values decoded so far */
 } lex_t;
 
 #define stream_to_lex(stream) container_of(stream, lex_t, stream)
@@ -141,6 +160,7 @@ stream_init(stream_t *stream, get_func get, void *data)
     stream->data = data;
     stream->buffer[0] = '\0';
     stream->buffer_pos = 0;
+    stream->pos = stream->end = stream->valid_end = NULL;
 
     stream->state = STREAM_STATE_OK;
     stream->line = 1;
@@ -148,14 +168,51 @@ stream_init(stream_t *stream, get_func get, void *data)
     stream->position = 0;
 }
 
-static int stream_get(stream_t *stream, json_error_t *error)
+static void
+stream_init_buffer(stream_t *stream, const char *buffer, size_t buflen)
+{
+    stream_init(stream, NULL, NULL);
+    stream->pos = stream->valid_end = buffer;
+    stream->end = buffer + buflen;
+}
+
+/* Validate the next chunk of in-memory input. Returns 0 if the input
+   at pos is not valid UTF-8. */
+static int stream_validate(stream_t *stream)
+{
+    size_t length = stream->end - stream->pos;
+    if(length > STREAM_VALIDATE_CHUNK)
+        length = STREAM_VALIDATE_CHUNK;
+
+    stream->valid_end = stream->pos + scan_utf8(stream->pos, length);
+    return stream->valid_end != stream->pos;
+}
+
+static JSON_INLINE int stream_get(stream_t *stream, json_error_t *error)
 {
     int c;
 
     if(stream->state != STREAM_STATE_OK)
         return stream->state;
 
-    if(!stream->buffer[stream->buffer_pos])
+    if(!stream->get)
+    {
+        if(stream->pos == stream->valid_end)
+        {
+            if(stream->pos == stream->end) {
+                stream->state = STREAM_STATE_EOF;
+                return STREAM_STATE_EOF;
+            }
+
+            if(!stream_validate(stream)) {
+                c = (unsigned char)*stream->pos;
+                goto out;
+            }
+        }
+
+        c = *stream->pos++;
+    }
+    else if(!stream->buffer[stream->buffer_pos])
     {
         c = stream->get(stream->data);
         if(c == EOF) {
@@ -187,9 +244,11 @@ static int stream_get(stream_t *stream, json_error_t *error)
         }
         else
             stream->buffer[1] = '\0';
-    }
 
-    c = stream->buffer[stream->buffer_pos++];
+        c = stream->buffer[stream->buffer_pos++];
+    }
+    else
+        c = stream->buffer[stream->buffer_pos++];
 
     stream->position++;
     if(c == '\n') {
@@ -224,6 +283,12 @@ static void stream_unget(stream_t *stream, int c)
     else if(utf8_check_first(c))
         stream->column--;
 
+    if(!stream->get) {
+        stream->pos--;
+        assert(*stream->pos == c);
+        return;
+    }
+
     assert(stream->buffer_pos > 0);
     stream->buffer_pos--;
     assert(stream->buffer[stream->buffer_pos] == c);
@@ -240,6 +305,19 @@ static void lex_save(lex_t *lex, int c)
     strbuffer_append_byte(&lex->saved_text, c);
 }
 
+/* Clip a run of length bytes so that saving it exceeds max_text by
+   at most one byte, enough for the caller to notice */
+static size_t lex_save_room(const lex_t *lex, size_t length)
+{
+    size_t room;
+
+    if(lex->saved_text.length > lex->max_text)
+        return 0;
+
+    room = lex->max_text - lex->saved_text.length;
+    return length > room ? room + 1 : length;
+}
+
 static int lex_get_save(lex_t *lex, json_error_t *error)
 {
     int c = stream_get(&lex->stream, error);
@@ -248,6 +326,36 @@ static int lex_get_save(lex_t *lex, json_error_t *error)
     return c;
 }
 
+/* Save a whole run of plain string characters at once when reading
+   from memory */
+static void lex_save_plain(lex_t *lex)
+{
+    stream_t *stream = &lex->stream;
+    const char *end;
+    size_t length;
+
+    if(stream->get || stream->state != STREAM_STATE_OK)
+        return;
+
+    end = scan_string(stream->pos, stream->valid_end);
+    length = lex_save_room(lex, end - stream->pos);
+    end = stream->pos + length;
+    if(length) {
+        /* the run has no newlines, so only continuation bytes of
+           multi-byte sequences don't start a new column */
+        size_t continuations = 0;
+        const char *p;
+
+        for(p = stream->pos; p < end; p++)
+            continuations += ((unsigned char)*p & 0xC0) == 0x80;
+
+        strbuffer_append_bytes(&lex->saved_text, stream->pos, length);
+        stream->pos = end;
+        stream->position += length;
+        stream->column += length - continuations;
+    }
+}
+
 static void lex_unget(lex_t *lex, int c)
 {
     stream_unget(&lex->stream, c);
@@ -274,6 +382,17 @@ static void lex_unget_unsave(lex_t *lex, int c)
 
 static void lex_save_cached(lex_t *lex)
 {
+    if(!lex->stream.get) {
+        while(lex->stream.pos < lex->stream.valid_end &&
+              ((unsigned char)*lex->stream.pos & 0xC0) == 0x80)
+        {
+            lex_save(lex, *lex->stream.pos);
+            lex->stream.pos++;
+            lex->stream.position++;
+        }
+        return;
+    }
+
     while(lex->stream.buffer[lex->stream.buffer_pos] != '\0')
     {
         lex_save(lex, lex->stream.buffer[lex->stream.buffer_pos]);
@@ -284,7 +403,7 @@ static void lex_save_cached(lex_t *lex)
 
 static void lex_free_string(lex_t *lex)
 {
-    jsonp_free(lex->value.string.val);
+    jsonp_arena_free(lex->arena, lex->value.string.val);
     lex->value.string.val = NULL;
     lex->value.string.len = 0;
 }
@@ -316,19 +435,33 @@ static int32_t decode_unicode_escape(const char *str)
 static void lex_scan_string(lex_t *lex, json_error_t *error)
 {
     int c;
-    const char *p;
+    const char *p, *end;
     char *t;
     int i;
 
     lex->value.string.val = NULL;
     lex->token = TOKEN_INVALID;
 
+    if(lex->max_source < lex->max_text)
+        lex->max_text = lex->max_source;
+
+    lex_save_plain(lex);
     c = lex_get_save(lex, error);
 
     while(c != '"') {
         if(c == STREAM_STATE_ERROR)
             goto out;
 
+        else if(lex->saved_text.length > lex->max_text) {
+            /* The string can't be short enough anymore, so there's no
+               point in buffering the rest of it */
+            if(lex->saved_text.length > lex->max_source)
+                error_set(error, lex, "maximum string length exceeded");
+            else
+                error_set(error, lex, "maximum decoded size exceeded");
+            goto out;
+        }
+
         else if(c == STREAM_STATE_EOF) {
             error_set(error, lex, "premature end of input");
             goto out;
@@ -364,8 +497,10 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
                 goto out;
             }
         }
-        else
+        else {
+            lex_save_plain(lex);
             c = lex_get_save(lex, error);
+        }
     }
 
     /* the actual value is at most of the same length as the source
@@ -375,7 +510,12 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
          - two \uXXXX escapes (length 12) forming an UTF-16 surrogate pair
            are converted to 4 bytes
     */
-    t = jsonp_malloc(lex->saved_text.length + 1);
+    if(lex->saved_text.length + 1 > lex->limits.max_bytes - lex->bytes) {
+        error_set(error, lex, "maximum decoded size exceeded");
+        goto out;
+    }
+
+    t = jsonp_arena_malloc(lex->arena, lex->saved_text.length + 1);
     if(!t) {
         /* this is not very nice, since TOKEN_INVALID is returned */
         goto out;
@@ -384,6 +524,7 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
 
     /* + 1 to skip the " */
     p = strbuffer_value(&lex->saved_text) + 1;
+    end = strbuffer_value(&lex->saved_text) + lex->saved_text.length;
 
     while(*p != '"') {
         if(*p == '\\') {
@@ -455,11 +596,20 @@ static void lex_scan_string(lex_t *lex, json_error_t *error)
                 p++;
             }
         }
-        else
-            *(t++) = *(p++);
+        else {
+            /* copy a run of plain characters at once */
+            const char *q = scan_string(p + 1, end);
+            memcpy(t, p, q - p);
+            t += q - p;
+            p = q;
+        }
     }
     *t = '\0';
     lex->value.string.len = t - lex->value.string.val;
+    if(lex->value.string.len > lex->limits.max_string) {
+        error_set(error, lex, "maximum string length exceeded");
+        goto out;
+    }
     lex->token = TOKEN_STRING;
     return;
 
@@ -467,28 +617,67 @@ out:
     lex_free_string(lex);
 }
 
-#ifndef JANSSON_USING_CMAKE /* disabled if using cmake */
-#if JSON_INTEGER_IS_LONG_LONG
-#ifdef _MSC_VER  /* Microsoft Visual Studio */
-#define json_strtoint     _strtoi64
-#else
-#define json_strtoint     strtoll
-#endif
-#else
-#define json_strtoint     strtol
-#endif
-#endif
+/* Integers are accumulated as negative numbers, because the negative
+   range of json_int_t is larger than the positive one. Once the value
+   would overflow, the rest of the digits are still consumed but not
+   accumulated. */
+#define INTEGER_CUTOFF  (JSON_INTEGER_MIN / 10)
+#define INTEGER_CUTLIM  ((int)-(JSON_INTEGER_MIN % 10))
+
+static JSON_INLINE void add_digit(json_int_t *value, int *overflow, int c)
+{
+    int digit = c - '0';
+
+    if(*value < INTEGER_CUTOFF ||
+       (*value == INTEGER_CUTOFF && digit > INTEGER_CUTLIM))
+        *overflow = 1;
+    else
+        *value = *value * 10 - digit;
+}
+
+/* Consume a whole run of digits at once when reading from memory. The
+   digits are accumulated to value, unless it's NULL. */
+static void lex_scan_digits(lex_t *lex, json_int_t *value, int *overflow)
+{
+    stream_t *stream = &lex->stream;
+    const char *p, *end;
+    size_t length;
+
+    if(stream->get || stream->state != STREAM_STATE_OK)
+        return;
+
+    end = stream->pos + lex_save_room(lex, stream->valid_end - stream->pos);
+
+    if(value) {
+        for(p = stream->pos; p < end && l_isdigit(*p); p++)
+            add_digit(value, overflow, *p);
+    }
+    else {
+        for(p = stream->pos; p < end && l_isdigit(*p); p++)
+            ;
+    }
+
+    length = p - stream->pos;
+    if(length) {
+        strbuffer_append_bytes(&lex->saved_text, stream->pos, length);
+        stream->pos = p;
+        stream->position += length;
+        stream->column += length;
+    }
+}
 
 static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
 {
-    const char *saved_text;
-    char *end;
     double value;
+    json_int_t integer = 0;
+    int negative = 0, overflow = 0;
 
     lex->token = TOKEN_INVALID;
 
-    if(c == '-')
+    if(c == '-') {
+        negative = 1;
         c = lex_get_save(lex, error);
+    }
 
     if(c == '0') {
         c = lex_get_save(lex, error);
@@ -498,9 +687,16 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
         }
     }
     else if(l_isdigit(c)) {
+        add_digit(&integer, &overflow, c);
+        lex_scan_digits(lex, &integer, &overflow);
         c = lex_get_save(lex, error);
-        while(l_isdigit(c))
+        while(l_isdigit(c) && lex->saved_text.length <= lex->max_text) {
+            add_digit(&integer, &overflow, c);
+            lex_scan_digits(lex, &integer, &overflow);
             c = lex_get_save(lex, error);
+        }
+        if(lex->saved_text.length > lex->max_text)
+            goto too_long;
     }
     else {
         lex_unget_unsave(lex, c);
@@ -508,26 +704,25 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
     }
 
     if(c != '.' && c != 'E' && c != 'e') {
-        json_int_t value;
-
         lex_unget_unsave(lex, c);
 
-        saved_text = strbuffer_value(&lex->saved_text);
+        if(!negative) {
+            if(integer < -JSON_INTEGER_MAX)
+                overflow = 1;
+            else
+                integer = -integer;
+        }
 
-        errno = 0;
-        value = json_strtoint(saved_text, &end, 10);
-        if(errno == ERANGE) {
-            if(value < 0)
+        if(overflow) {
+            if(negative)
                 error_set(error, lex, "too big negative integer");
             else
                 error_set(error, lex, "too big integer");
             goto out;
         }
 
-        assert(end == saved_text + lex->saved_text.length);
-
         lex->token = TOKEN_INTEGER;
-        lex->value.integer = value;
+        lex->value.integer = integer;
         return 0;
     }
 
@@ -539,9 +734,14 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
         }
         lex_save(lex, c);
 
+        lex_scan_digits(lex, NULL, NULL);
         c = lex_get_save(lex, error);
-        while(l_isdigit(c))
+        while(l_isdigit(c) && lex->saved_text.length <= lex->max_text) {
+            lex_scan_digits(lex, NULL, NULL);
             c = lex_get_save(lex, error);
+        }
+        if(lex->saved_text.length > lex->max_text)
+            goto too_long;
     }
 
     if(c == 'E' || c == 'e') {
@@ -554,9 +754,14 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
             goto out;
         }
 
+        lex_scan_digits(lex, NULL, NULL);
         c = lex_get_save(lex, error);
-        while(l_isdigit(c))
+        while(l_isdigit(c) && lex->saved_text.length <= lex->max_text) {
+            lex_scan_digits(lex, NULL, NULL);
             c = lex_get_save(lex, error);
+        }
+        if(lex->saved_text.length > lex->max_text)
+            goto too_long;
     }
 
     lex_unget_unsave(lex, c);
@@ -570,6 +775,8 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
     lex->value.real = value;
     return 0;
 
+too_long:
+    error_set(error, lex, "maximum decoded size exceeded");
 out:
     return -1;
 }
@@ -579,6 +786,7 @@ static int lex_scan(lex_t *lex, json_error_t *error)
     int c;
 
     strbuffer_clear(&lex->saved_text);
+    lex->max_text = lex->limits.max_bytes - lex->bytes;
 
     if(lex->token == TOKEN_STRING)
         lex_free_string(lex);
@@ -615,8 +823,15 @@ static int lex_scan(lex_t *lex, json_error_t *error)
         const char *saved_text;
 
         c = lex_get_save(lex, error);
-        while(l_isalpha(c))
+        while(l_isalpha(c) && lex->saved_text.length <= lex->max_text)
             c = lex_get_save(lex, error);
+
+        if(l_isalpha(c)) {
+            /* stopped at the limit, the identifier is still going */
+            error_set(error, lex, "maximum decoded size exceeded");
+            lex->token = TOKEN_INVALID;
+            goto out;
+        }
         lex_unget_unsave(lex, c);
 
         saved_text = strbuffer_value(&lex->saved_text);
@@ -654,13 +869,60 @@ static char *lex_steal_string(lex_t *lex, size_t *out_len)
     return result;
 }
 
-static int lex_init(lex_t *lex, get_func get, void *data)
+static void lex_init_limits(lex_t *lex, const json_load_limits_t *limits)
+{
+    json_load_limits_t *l = &lex->limits;
+
+    if(limits)
+        *l = *limits;
+    else
+        memset(l, 0, sizeof(json_load_limits_t));
+
+    if(!l->max_depth)
+        l->max_depth = JSON_PARSER_MAX_DEPTH;
+    if(!l->max_bytes)
+        l->max_bytes = (size_t)-1;
+    if(!l->max_string)
+        l->max_string = (size_t)-1;
+    if(!l->max_elements)
+        l->max_elements = (size_t)-1;
+
+    /* A \uXXXX escape takes 6 bytes in the source and decodes to at
+       least one byte. Add the opening quote. */
+    if(l->max_string < ((size_t)-1 - 1) / 6)
+        lex->max_source = l->max_string * 6 + 1;
+    else
+        lex->max_source = (size_t)-1;
+
+    lex->depth = 0;
+    lex->bytes = 0;
+    lex->max_text = l->max_bytes;
+}
+
+static int lex_init(lex_t *lex, get_func get, void *data,
+                    json_arena_t *arena, const json_load_limits_t *limits)
 {
     stream_init(&lex->stream, get, data);
     if(strbuffer_init(&lex->saved_text))
         return -1;
 
     lex->token = TOKEN_INVALID;
+    lex->arena = arena;
+    lex_init_limits(lex, limits);
+    return 0;
+}
+
+static int lex_init_buffer(lex_t *lex, const char *buffer, size_t buflen,
+                           json_arena_t *arena,
+                           const json_load_limits_t *limits)
+{
+    stream_init_buffer(&lex->stream, buffer, buflen);
+    if(strbuffer_init(&lex->saved_text))
+        return -1;
+
+    lex->token = TOKEN_INVALID;
+    lex->arena = arena;
+    lex_init_limits(lex, limits);
     return 0;
 }
 
@@ -674,13 +936,33 @@ static void lex_close(lex_t *lex)
 
 /*** parser ***/
 
+/* Count bytes of memory held by the decoded value against the limit */
+static int parse_charge(lex_t *lex, size_t bytes, json_error_t *error)
+{
+    if(bytes > lex->limits.max_bytes - lex->bytes) {
+        error_set(error, lex, "maximum decoded size exceeded");
+        return -1;
+    }
+
+    lex->bytes += bytes;
+    return 0;
+}
+
 static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error);
 
 static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error)
 {
-    json_t *object = json_object();
+    json_t *object;
+    hashtable_t *hashtable;
+    size_t index_usage = 0, size;
+
+    if(parse_charge(lex, sizeof(json_object_t), error))
+        return NULL;
+
+    object = json_arena_object(lex->arena);
     if(!object)
         return NULL;
+    hashtable = &json_to_object(object)->hashtable;
 
     lex_scan(lex, error);
     if(lex->token == '}')
@@ -700,22 +982,30 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error)
         if(!key)
             return NULL;
         if (memchr(key, '\0', len)) {
-            jsonp_free(key);
+            jsonp_arena_free(lex->arena, key);
             error_set(error, lex, "NUL byte in object key not supported");
             goto error;
         }
 
         if(flags & JSON_REJECT_DUPLICATES) {
-            if(json_object_get(object, key)) {
-                jsonp_free(key);
+            if(json_object_getn(object, key, len)) {
+                jsonp_arena_free(lex->arena, key);
                 error_set(error, lex, "duplicate object key");
                 goto error;
             }
         }
 
+        /* Duplicate keys replace a member instead of adding one */
+        if(hashtable->size >= lex->limits.max_elements &&
+           !json_object_getn(object, key, len)) {
+            jsonp_arena_free(lex->arena, key);
+            error_set(error, lex, "too many object members");
+            goto error;
+        }
+
         lex_scan(lex, error);
         if(lex->token != ':') {
-            jsonp_free(key);
+            jsonp_arena_free(lex->arena, key);
             error_set(error, lex, "':' expected");
             goto error;
         }
@@ -723,18 +1013,33 @@ static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error)
         lex_scan(lex, error);
         value = parse_value(lex, flags, error);
         if(!value) {
-            jsonp_free(key);
+            jsonp_arena_free(lex->arena, key);
             goto error;
         }
 
-        if(json_object_set_nocheck(object, key, value)) {
-            jsonp_free(key);
+        size = hashtable->size;
+        if(json_object_setn_nocheck(object, key, len, value)) {
+            jsonp_arena_free(lex->arena, key);
             json_decref(value);
             goto error;
         }
 
         json_decref(value);
-        jsonp_free(key);
+        jsonp_arena_free(lex->arena, key);
+
+        if(hashtable->size != size) {
+            if(parse_charge(lex, offsetof(struct hashtable_pair, key) +
+                                 len + 1, error))
+                goto error;
+
+            /* The index only counts at its largest */
+            if(hashtable_index_usage(hashtable) > index_usage) {
+                size = hashtable_index_usage(hashtable);
+                if(parse_charge(lex, size - index_usage, error))
+                    goto error;
+                index_usage = size;
+            }
+        }
 
         lex_scan(lex, error);
         if(lex->token != ',')
@@ -757,7 +1062,14 @@ error:
 
 static json_t *parse_array(lex_t *lex, size_t flags, json_error_t *error)
 {
-    json_t *array = json_array();
+    json_t *array;
+    size_t table_size = ARRAY_INITIAL_SIZE;
+
+    if(parse_charge(lex, sizeof(json_array_t) +
+                         table_size * sizeof(json_t *), error))
+        return NULL;
+
+    array = json_arena_array(lex->arena);
     if(!array)
         return NULL;
 
@@ -766,7 +1078,14 @@ static json_t *parse_array(lex_t *lex, size_t flags, json_error_t *error)
         return array;
 
     while(lex->token) {
-        json_t *elem = parse_value(lex, flags, error);
+        json_t *elem;
+
+        if(json_array_size(array) >= lex->limits.max_elements) {
+            error_set(error, lex, "too many array elements");
+            goto error;
+        }
+
+        elem = parse_value(lex, flags, error);
         if(!elem)
             goto error;
 
@@ -776,6 +1095,13 @@ static json_t *parse_array(lex_t *lex, size_t flags, json_error_t *error)
         }
         json_decref(elem);
 
+        if(json_to_array(array)->size != table_size) {
+            if(parse_charge(lex, (json_to_array(array)->size - table_size) *
+                                 sizeof(json_t *), error))
+                goto error;
+            table_size = json_to_array(array)->size;
+        }
+
         lex_scan(lex, error);
         if(lex->token != ',')
             break;
@@ -812,7 +1138,12 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error)
                 }
             }
 
-            json = jsonp_stringn_nocheck_own(value, len);
+            /* The string owns the buffer the lexer decoded it into */
+            if(parse_charge(lex, sizeof(json_string_t) +
+                                 lex->saved_text.length + 1, error))
+                return NULL;
+
+            json = jsonp_stringn_nocheck_own(lex->arena, value, len);
             if(json) {
                 lex->value.string.val = NULL;
                 lex->value.string.len = 0;
@@ -821,20 +1152,26 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error)
         }
 
         case TOKEN_INTEGER: {
+            if(parse_charge(lex, sizeof(json_integer_t), error))
+                return NULL;
+
             if (flags & JSON_DECODE_INT_AS_REAL) {
                 if(jsonp_strtod(&lex->saved_text, &value)) {
                     error_set(error, lex, "real number overflow");
                     return NULL;
                 }
-                json = json_real(value);
+                json = json_arena_real(lex->arena, value);
             } else {
-                json = json_integer(lex->value.integer);
+                json = json_arena_integer(lex->arena, lex->value.integer);
             }
             break;
         }
 
         case TOKEN_REAL: {
-            json = json_real(lex->value.real);
+            if(parse_charge(lex, sizeof(json_real_t), error))
+                return NULL;
+
+            json = json_arena_real(lex->arena, lex->value.real);
             break;
         }
 
@@ -851,11 +1188,18 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error)
             break;
 
         case '{':
-            json = parse_object(lex, flags, error);
-            break;
-
         case '[':
-            json = parse_array(lex, flags, error);
+            if(lex->depth >= lex->limits.max_depth) {
+                error_set(error, lex, "maximum parsing depth reached");
+                return NULL;
+            }
+
+            lex->depth++;
+            if(lex->token == '{')
+                json = parse_object(lex, flags, error);
+            else
+                json = parse_array(lex, flags, error);
+            lex->depth--;
             break;
 
         case TOKEN_INVALID:
@@ -906,31 +1250,11 @@ static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error)
     return result;
 }
 
-typedef struct
-{
-    const char *data;
-    int pos;
-} string_data_t;
-
-static int string_get(void *data)
-{
-    char c;
-    string_data_t *stream = (string_data_t *)data;
-    c = stream->data[stream->pos];
-    if(c == '\0')
-        return EOF;
-    else
-    {
-        stream->pos++;
-        return (unsigned char)c;
-    }
-}
-
-json_t *json_loads(const char *string, size_t flags, json_error_t *error)
+json_t *json_loads_ex(json_arena_t *arena, const char *string, size_t flags,
+                      const json_load_limits_t *limits, json_error_t *error)
 {
     lex_t lex;
     json_t *result;
-    string_data_t stream_data;
 
     jsonp_error_init(error, "<string>");
 
@@ -939,10 +1263,7 @@ json_t *json_loads(const char *string, size_t flags, json_error_t *error)
         return NULL;
     }
 
-    stream_data.data = string;
-    stream_data.pos = 0;
-
-    if(lex_init(&lex, string_get, (void *)&stream_data))
+    if(lex_init_buffer(&lex, string, strlen(string), arena, limits))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -951,30 +1272,23 @@ json_t *json_loads(const char *string, size_t flags, json_error_t *error)
     return result;
 }
 
-typedef struct
+json_t *json_loads_arena(json_arena_t *arena, const char *string,
+                         size_t flags, json_error_t *error)
 {
-    const char *data;
-    size_t len;
-    size_t pos;
-} buffer_data_t;
+    return json_loads_ex(arena, string, flags, NULL, error);
+}
 
-static int buffer_get(void *data)
+json_t *json_loads(const char *string, size_t flags, json_error_t *error)
 {
-    char c;
-    buffer_data_t *stream = data;
-    if(stream->pos >= stream->len)
-      return EOF;
-
-    c = stream->data[stream->pos];
-    stream->pos++;
-    return (unsigned char)c;
+    return json_loads_ex(NULL, string, flags, NULL, error);
 }
 
-json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error)
+json_t *json_loadb_ex(json_arena_t *arena, const char *buffer, size_t buflen,
+                      size_t flags, const json_load_limits_t *limits,
+                      json_error_t *error)
 {
     lex_t lex;
     json_t *result;
-    buffer_data_t stream_data;
 
     jsonp_error_init(error, "<buffer>");
 
@@ -983,11 +1297,7 @@ json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t
         return NULL;
     }
 
-    stream_data.data = buffer;
-    stream_data.pos = 0;
-    stream_data.len = buflen;
-
-    if(lex_init(&lex, buffer_get, (void *)&stream_data))
+    if(lex_init_buffer(&lex, buffer, buflen, arena, limits))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -996,7 +1306,19 @@ json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t
     return result;
 }
 
-json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
+json_t *json_loadb_arena(json_arena_t *arena, const char *buffer,
+                         size_t buflen, size_t flags, json_error_t *error)
+{
+    return json_loadb_ex(arena, buffer, buflen, flags, NULL, error);
+}
+
+json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error)
+{
+    return json_loadb_ex(NULL, buffer, buflen, flags, NULL, error);
+}
+
+json_t *json_loadf_ex(json_arena_t *arena, FILE *input, size_t flags,
+                      const json_load_limits_t *limits, json_error_t *error)
 {
     lex_t lex;
     const char *source;
@@ -1014,7 +1336,7 @@ json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
         return NULL;
     }
 
-    if(lex_init(&lex, (get_func)fgetc, input))
+    if(lex_init(&lex, (get_func)fgetc, input, arena, limits))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -1023,7 +1345,20 @@ json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
     return result;
 }
 
-json_t *json_load_file(const char *path, size_t flags, json_error_t *error)
+json_t *json_loadf_arena(json_arena_t *arena, FILE *input, size_t flags,
+                         json_error_t *error)
+{
+    return json_loadf_ex(arena, input, flags, NULL, error);
+}
+
+json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
+{
+    return json_loadf_ex(NULL, input, flags, NULL, error);
+}
+
+json_t *json_load_file_ex(json_arena_t *arena, const char *path, size_t flags,
+                          const json_load_limits_t *limits,
+                          json_error_t *error)
 {
     json_t *result;
     FILE *fp;
@@ -1043,12 +1378,23 @@ json_t *json_load_file(const char *path, size_t flags, json_error_t *error)
         return NULL;
     }
 
-    result = json_loadf(fp, flags, error);
+    result = json_loadf_ex(arena, fp, flags, limits, error);
 
     fclose(fp);
     return result;
 }
 
+json_t *json_load_file_arena(json_arena_t *arena, const char *path,
+                             size_t flags, json_error_t *error)
+{
+    return json_load_file_ex(arena, path, flags, NULL, error);
+}
+
+json_t *json_load_file(const char *path, size_t flags, json_error_t *error)
+{
+    return json_load_file_ex(NULL, path, flags, NULL, error);
+}
+
 #define MAX_BUF_LEN 1024
 
 typedef struct
@@ -1077,7 +1423,10 @@ static int callback_get(void *data)
     return (unsigned char)c;
 }
 
-json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flags, json_error_t *error)
+json_t *json_load_callback_ex(json_arena_t *arena,
+                              json_load_callback_t callback, void *arg,
+                              size_t flags, const json_load_limits_t *limits,
+                              json_error_t *error)
 {
     lex_t lex;
     json_t *result;
@@ -1095,7 +1444,7 @@ json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flag
         return NULL;
     }
 
-    if(lex_init(&lex, (get_func)callback_get, &stream_data))
+    if(lex_init(&lex, (get_func)callback_get, &stream_data, arena, limits))
         return NULL;
 
     result = parse_json(&lex, flags, error);
@@ -1103,3 +1452,15 @@ json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flag
     lex_close(&lex);
     return result;
 }
+
+json_t *json_load_callback_arena(json_arena_t *arena,
+                                 json_load_callback_t callback, void *arg,
+                                 size_t flags, json_error_t *error)
+{
+    return json_load_callback_ex(arena, callback, arg, flags, NULL, error);
+}
+
+json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flags, json_error_t *error)
+{
+    return json_load_callback_ex(NULL, callback, arg, flags, NULL, error);
+}
@@ -6,26 +6,212 @@
  * under the terms of the MIT license. See LICENSE for details.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef USE_NODE_POOLS
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
+#endif
+
 #include "jansson.h"
 #include "jansson_private.h"
 
 /* C89 allows these to be macros */
 #undef malloc
+#undef realloc
 #undef free
 
-/* memory function pointers */
+static void *default_realloc(void *ptr, size_t size, void *ctx)
+{
+    (void)ctx;
+    return realloc(ptr, size);
+}
+
+static void pools_next_generation(void);
+
+/* memory function pointers. The _ex functions are used if they're
+   set, and do_realloc may be NULL. */
 static json_malloc_t do_malloc = malloc;
 static json_free_t do_free = free;
+static json_malloc_ex_t do_malloc_ex = NULL;
+static json_realloc_ex_t do_realloc = default_realloc;
+static json_free_ex_t do_free_ex = NULL;
+static void *alloc_ctx = NULL;
+
+static JSON_INLINE void *call_malloc(size_t size)
+{
+    if(do_malloc_ex)
+        return (*do_malloc_ex)(size, alloc_ctx);
+
+    return (*do_malloc)(size);
+}
+
+static JSON_INLINE void call_free(void *ptr)
+{
+    if(do_free_ex)
+        (*do_free_ex)(ptr, alloc_ctx);
+    else
+        (*do_free)(ptr);
+}
+
+/* Give the unused end of a block being handed to the user back to
+   the allocator, if it's more than a quarter of the block. Without a
+   realloc function that would mean a copy, so the block is kept. */
+static void *release_trim(void *block, size_t size, size_t used)
+{
+    void *trimmed;
+
+    if(!do_realloc || !used || size - used <= size / 4)
+        return block;
+
+    trimmed = (*do_realloc)(block, used, alloc_ctx);
+    return trimmed ? trimmed : block;
+}
+
+/* Memory is aligned for any of these */
+typedef union {
+    void *pointer;
+    double real;
+    json_int_t integer;
+    size_t size;
+} align_t;
+
+#ifdef USE_MEMORY_STATS
+
+/* Each block starts with a header that holds its size, so that the
+   live bytes can be counted when it's freed */
+typedef union {
+    size_t size;
+    align_t align;
+} block_header_t;
+
+#define BLOCK_HEADER  sizeof(block_header_t)
+
+static size_t stat_allocs;
+static size_t stat_frees;
+static size_t stat_bytes;
+static size_t stat_rehashes;
+static size_t stat_array_grows;
+
+#if defined(HAVE_ATOMIC_BUILTINS)
+#define stat_add(counter_, n_) \
+    ((void)__atomic_fetch_add(&(counter_), (n_), __ATOMIC_RELAXED))
+#define stat_get(counter_)  __atomic_load_n(&(counter_), __ATOMIC_RELAXED)
+#elif defined(HAVE_SYNC_BUILTINS)
+#define stat_add(counter_, n_)  ((void)__sync_fetch_and_add(&(counter_), (n_)))
+#define stat_get(counter_)  __sync_fetch_and_add(&(counter_), 0)
+#else
+/* Without atomic operations the counters are only exact if a single
+   thread uses Jansson at a time */
+#define stat_add(counter_, n_)  ((void)((counter_) += (n_)))
+#define stat_get(counter_)  (counter_)
+#endif
+
+void *jsonp_malloc(size_t size)
+{
+    block_header_t *header;
+
+    if(!size || size > (size_t)-1 - BLOCK_HEADER)
+        return NULL;
+
+    header = call_malloc(BLOCK_HEADER + size);
+    if(!header)
+        return NULL;
+
+    header->size = size;
+    stat_add(stat_allocs, 1);
+    stat_add(stat_bytes, size);
+    return header + 1;
+}
+
+void jsonp_free(void *ptr)
+{
+    block_header_t *header;
+
+    if(!ptr)
+        return;
+
+    header = (block_header_t *)ptr - 1;
+    stat_add(stat_frees, 1);
+    stat_add(stat_bytes, 0 - header->size);
+    call_free(header);
+}
+
+static void *call_realloc(void *ptr, size_t size)
+{
+    block_header_t *header = (block_header_t *)ptr - 1;
+    size_t old_size = header->size;
+
+    if(size > (size_t)-1 - BLOCK_HEADER)
+        return NULL;
+
+    header = (*do_realloc)(header, BLOCK_HEADER + size, alloc_ctx);
+    if(!header)
+        return NULL;
+
+    header->size = size;
+    stat_add(stat_bytes, size - old_size);
+    return header + 1;
+}
+
+void *jsonp_release(void *ptr, size_t size, size_t used)
+{
+    block_header_t *header;
+
+    if(!ptr)
+        return NULL;
+
+    /* Move the data over the header, so that the caller can pass the
+       block to the free function. This copies the used part once. */
+    header = (block_header_t *)ptr - 1;
+    size = header->size;
+    memmove(header, ptr, used);
+
+    stat_add(stat_frees, 1);
+    stat_add(stat_bytes, 0 - size);
+    return release_trim(header, BLOCK_HEADER + size, used);
+}
+
+void jsonp_count_rehash(void)
+{
+    stat_add(stat_rehashes, 1);
+}
+
+void jsonp_count_array_grow(void)
+{
+    stat_add(stat_array_grows, 1);
+}
+
+int json_memory_stats(json_memory_stats_t *stats)
+{
+    if(!stats)
+        return -1;
+
+    stats->allocs = stat_get(stat_allocs);
+    stats->frees = stat_get(stat_frees);
+    stats->bytes = stat_get(stat_bytes);
+    stats->rehashes = stat_get(stat_rehashes);
+    stats->array_grows = stat_get(stat_array_grows);
+    return 0;
+}
+
+#else /* USE_MEMORY_STATS */
 
 void *jsonp_malloc(size_t size)
 {
     if(!size)
         return NULL;
 
-    return (*do_malloc)(size);
+    return call_malloc(size);
 }
 
 void jsonp_free(void *ptr)
@@ -33,7 +219,59 @@ void jsonp_free(void *ptr)
     if(!ptr)
         return;
 
-    (*do_free)(ptr);
+    call_free(ptr);
+}
+
+static JSON_INLINE void *call_realloc(void *ptr, size_t size)
+{
+    return (*do_realloc)(ptr, size, alloc_ctx);
+}
+
+void *jsonp_release(void *ptr, size_t size, size_t used)
+{
+    if(!ptr)
+        return NULL;
+
+    return release_trim(ptr, size, used);
+}
+
+void jsonp_count_rehash(void)
+{
+}
+
+void jsonp_count_array_grow(void)
+{
+}
+
+int json_memory_stats(json_memory_stats_t *stats)
+{
+    if(stats)
+        memset(stats, 0, sizeof(json_memory_stats_t));
+    return -1;
+}
+
+#endif /* USE_MEMORY_STATS */
+
+void *jsonp_realloc(void *ptr, size_t old_size, size_t size)
+{
+    void *new_ptr;
+
+    if(!ptr)
+        return jsonp_malloc(size);
+
+    if(!size)
+        return NULL;
+
+    if(do_realloc)
+        return call_realloc(ptr, size);
+
+    new_ptr = jsonp_malloc(size);
+    if(!new_ptr)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    jsonp_free(ptr);
+    return new_ptr;
 }
 
 char *jsonp_strdup(const char *str)
@@ -56,6 +294,431 @@ char *jsonp_strndup(const char *str, size_t len)
 
 void json_set_alloc_funcs(json_malloc_t malloc_fn, json_free_t free_fn)
 {
+    /* Cached nodes must go back to the functions they came from */
+    json_pool_release();
+
     do_malloc = malloc_fn;
     do_free = free_fn;
+    do_malloc_ex = NULL;
+    do_realloc = NULL;
+    do_free_ex = NULL;
+    alloc_ctx = NULL;
+
+    /* Other threads drop the nodes they cached until now */
+    pools_next_generation();
+}
+
+void json_set_alloc_funcs_ex(json_malloc_ex_t malloc_fn,
+                             json_realloc_ex_t realloc_fn,
+                             json_free_ex_t free_fn, void *ctx)
+{
+    json_pool_release();
+
+    /* Without both functions, go back to the defaults rather than
+       pair one of them with a function of the old allocator */
+    if(!malloc_fn || !free_fn)
+    {
+        do_malloc = malloc;
+        do_free = free;
+        malloc_fn = NULL;
+        realloc_fn = default_realloc;
+        free_fn = NULL;
+        ctx = NULL;
+    }
+
+    do_malloc_ex = malloc_fn;
+    do_realloc = realloc_fn;
+    do_free_ex = free_fn;
+    alloc_ctx = ctx;
+
+    pools_next_generation();
+}
+
+
+/*** arenas ***/
+
+/* Arena allocations are aligned like other memory */
+#define ARENA_ALIGN  sizeof(align_t)
+
+/* The first block of an arena has room for ARENA_MIN_BLOCK bytes, and
+   each new block is twice the size of the previous one, up to
+   ARENA_MAX_BLOCK. Allocations larger than a quarter of the block size
+   get a block of their own. */
+#define ARENA_MIN_BLOCK  4096
+#define ARENA_MAX_BLOCK  (1024 * 1024)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    align_t data[1];
+} arena_block_t;
+
+/* Values are carved out of the current block, from pos to end. Nothing
+   is freed before the whole arena is. */
+struct json_arena_t {
+    arena_block_t *blocks;  /* the current block is the first one */
+    char *pos;
+    char *end;
+    size_t block_size;      /* size of the next block */
+};
+
+json_arena_t *json_arena_create(void)
+{
+    json_arena_t *arena = jsonp_malloc(sizeof(json_arena_t));
+    if(!arena)
+        return NULL;
+
+    arena->blocks = NULL;
+    arena->pos = NULL;
+    arena->end = NULL;
+    arena->block_size = ARENA_MIN_BLOCK;
+    return arena;
+}
+
+void json_arena_destroy(json_arena_t *arena)
+{
+    arena_block_t *block, *next;
+
+    if(!arena)
+        return;
+
+    for(block = arena->blocks; block; block = next)
+    {
+        next = block->next;
+        jsonp_free(block);
+    }
+    jsonp_free(arena);
+}
+
+static arena_block_t *arena_block_alloc(size_t size)
+{
+    arena_block_t *block;
+
+    if(size > (size_t)-1 - offsetof(arena_block_t, data))
+        return NULL;
+
+    block = jsonp_malloc(offsetof(arena_block_t, data) + size);
+    if(!block)
+        return NULL;
+
+    block->next = NULL;
+    return block;
+}
+
+static void *arena_alloc_slow(json_arena_t *arena, size_t size)
+{
+    arena_block_t *block;
+
+    if(size > arena->block_size / 4)
+    {
+        /* Keep allocating from the current block after this */
+        block = arena_block_alloc(size);
+        if(!block)
+            return NULL;
+
+        if(arena->blocks)
+        {
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        }
+        else
+            arena->blocks = block;
+
+        return block->data;
+    }
+
+    block = arena_block_alloc(arena->block_size);
+    if(!block)
+        return NULL;
+
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->pos = (char *)block->data + size;
+    arena->end = (char *)block->data + arena->block_size;
+
+    if(arena->block_size < ARENA_MAX_BLOCK)
+        arena->block_size *= 2;
+
+    return block->data;
+}
+
+void *jsonp_arena_malloc(json_arena_t *arena, size_t size)
+{
+    void *ptr;
+
+    if(!arena)
+        return jsonp_malloc(size);
+
+    if(!size || size > (size_t)-1 - ARENA_ALIGN)
+        return NULL;
+
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if((size_t)(arena->end - arena->pos) < size)
+        return arena_alloc_slow(arena, size);
+
+    ptr = arena->pos;
+    arena->pos += size;
+    return ptr;
+}
+
+void *jsonp_arena_realloc(json_arena_t *arena, void *ptr, size_t old_size,
+                          size_t size)
+{
+    void *new_ptr;
+
+    if(!arena)
+        return jsonp_realloc(ptr, old_size, size);
+
+    new_ptr = jsonp_arena_malloc(arena, size);
+    if(!new_ptr)
+        return NULL;
+
+    if(ptr)
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    return new_ptr;
+}
+
+void jsonp_arena_free(json_arena_t *arena, void *ptr)
+{
+    /* Arena memory is released with the arena */
+    if(!arena)
+        jsonp_free(ptr);
 }
+
+
+/*** node pools ***/
+
+#ifdef USE_NODE_POOLS
+#if defined(_MSC_VER)
+#define JSON_THREAD_LOCAL  __declspec(thread)
+#elif defined(HAVE_THREAD_LOCAL)
+#define JSON_THREAD_LOCAL  __thread
+#endif
+#endif
+
+#ifdef JSON_THREAD_LOCAL
+
+/* Freed nodes of up to POOL_MAX_SIZE bytes are kept on a per-thread
+   free list for their size class, and handed out again before asking
+   jsonp_malloc() for more. At most POOL_MAX_NODES nodes are kept per
+   class, the rest are freed. */
+#define POOL_GRANULARITY  16
+#define POOL_CLASSES      8
+#define POOL_MAX_SIZE     (POOL_GRANULARITY * POOL_CLASSES)
+#define POOL_MAX_NODES    1024
+
+#define pool_class(size_)  (((size_) - 1) / POOL_GRANULARITY)
+
+typedef struct pool_node {
+    struct pool_node *next;
+} pool_node_t;
+
+typedef struct {
+    pool_node_t *head;
+    size_t count;
+} pool_t;
+
+/* The pools of a thread. Nodes cached under an older allocator
+   generation came from functions that have since been replaced, so
+   they're dropped instead of being handed out or passed to the new
+   free function. */
+typedef struct {
+    pool_t classes[POOL_CLASSES];
+    size_t generation;
+    int registered;     /* released when the thread exits */
+} thread_pools_t;
+
+static JSON_THREAD_LOCAL thread_pools_t pools;
+static size_t alloc_generation;
+
+#if defined(HAVE_ATOMIC_BUILTINS)
+#define generation_get()  __atomic_load_n(&alloc_generation, __ATOMIC_RELAXED)
+#define generation_bump() \
+    ((void)__atomic_fetch_add(&alloc_generation, 1, __ATOMIC_RELAXED))
+#elif defined(HAVE_SYNC_BUILTINS)
+#define generation_get()  __sync_fetch_and_add(&alloc_generation, 0)
+#define generation_bump() ((void)__sync_fetch_and_add(&alloc_generation, 1))
+#else
+#define generation_get()  (alloc_generation)
+#define generation_bump() ((void)alloc_generation++)
+#endif
+
+static void pools_release(thread_pools_t *p, int stale)
+{
+    pool_node_t *node, *next;
+    size_t i;
+
+    for(i = 0; i < POOL_CLASSES; i++)
+    {
+        if(!stale)
+        {
+            for(node = p->classes[i].head; node; node = next)
+            {
+                next = node->next;
+                jsonp_free(node);
+            }
+        }
+        p->classes[i].head = NULL;
+        p->classes[i].count = 0;
+    }
+}
+
+static JSON_INLINE thread_pools_t *pools_get(void)
+{
+    size_t generation = generation_get();
+
+    if(pools.generation != generation)
+    {
+        pools_release(&pools, 1);
+        pools.generation = generation;
+    }
+    return &pools;
+}
+
+static void pools_destroy(void *ptr)
+{
+    thread_pools_t *p = ptr;
+
+    /* Nodes freed by later destructors register the pools again */
+    pools_release(p, p->generation != generation_get());
+    p->registered = 0;
+}
+
+#if defined(_WIN32)
+
+static DWORD pools_key = FLS_OUT_OF_INDEXES;
+static INIT_ONCE pools_once = INIT_ONCE_STATIC_INIT;
+
+static void WINAPI pools_destroy_fls(void *ptr)
+{
+    if(ptr)
+        pools_destroy(ptr);
+}
+
+static BOOL CALLBACK pools_key_create(INIT_ONCE *once, void *param,
+                                      void **context)
+{
+    (void)once;
+    (void)param;
+    (void)context;
+    pools_key = FlsAlloc(pools_destroy_fls);
+    return TRUE;
+}
+
+static int pools_register(thread_pools_t *p)
+{
+    InitOnceExecuteOnce(&pools_once, pools_key_create, NULL, NULL);
+    if(pools_key == FLS_OUT_OF_INDEXES || !FlsSetValue(pools_key, p))
+        return -1;
+
+    p->registered = 1;
+    return 0;
+}
+
+#elif defined(HAVE_PTHREAD_H)
+
+static pthread_key_t pools_key;
+static pthread_once_t pools_once = PTHREAD_ONCE_INIT;
+static int pools_key_ok;
+
+static void pools_key_create(void)
+{
+    pools_key_ok = pthread_key_create(&pools_key, pools_destroy) == 0;
+}
+
+static int pools_register(thread_pools_t *p)
+{
+    if(pthread_once(&pools_once, pools_key_create) || !pools_key_ok ||
+       pthread_setspecific(pools_key, p))
+        return -1;
+
+    p->registered = 1;
+    return 0;
+}
+
+#else
+
+/* Without a way to run code at thread exit, the pools are only freed
+   by json_pool_release() */
+static int pools_register(thread_pools_t *p)
+{
+    p->registered = 1;
+    return 0;
+}
+
+#endif
+
+void *jsonp_node_malloc(json_arena_t *arena, size_t size)
+{
+    pool_t *pool;
+    pool_node_t *node;
+
+    if(arena || !size || size > POOL_MAX_SIZE)
+        return jsonp_arena_malloc(arena, size);
+
+    pool = &pools_get()->classes[pool_class(size)];
+    node = pool->head;
+    if(!node)
+        return jsonp_malloc((pool_class(size) + 1) * POOL_GRANULARITY);
+
+    pool->head = node->next;
+    pool->count--;
+    return node;
+}
+
+void jsonp_node_free(json_arena_t *arena, void *ptr, size_t size)
+{
+    thread_pools_t *p;
+    pool_t *pool;
+    pool_node_t *node;
+
+    if(arena || !ptr || !size || size > POOL_MAX_SIZE) {
+        jsonp_arena_free(arena, ptr);
+        return;
+    }
+
+    p = pools_get();
+    pool = &p->classes[pool_class(size)];
+    if(pool->count >= POOL_MAX_NODES ||
+       (!p->registered && pools_register(p))) {
+        jsonp_free(ptr);
+        return;
+    }
+
+    node = ptr;
+    node->next = pool->head;
+    pool->head = node;
+    pool->count++;
+}
+
+void json_pool_release(void)
+{
+    pools_release(pools_get(), 0);
+}
+
+static void pools_next_generation(void)
+{
+    generation_bump();
+}
+
+#else /* JSON_THREAD_LOCAL */
+
+void *jsonp_node_malloc(json_arena_t *arena, size_t size)
+{
+    return jsonp_arena_malloc(arena, size);
+}
+
+void jsonp_node_free(json_arena_t *arena, void *ptr, size_t size)
+{
+    (void)size;
+    jsonp_arena_free(arena, ptr);
+}
+
+void json_pool_release(void)
+{
+}
+
+static void pools_next_generation(void)
+{
+}
+
+#endif /* JSON_THREAD_LOCAL */
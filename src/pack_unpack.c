@@ -239,7 +239,7 @@ static json_t *pack_object(scanner_t *s, va_list *ap)
             goto error;
         }
 
-        if(json_object_set_new_nocheck(object, key, value)) {
+        if(json_object_setn_new_nocheck(object, key, len, value)) {
             if(ours)
                 jsonp_free(key);
 
@@ -311,7 +311,7 @@ static json_t *pack(scanner_t *s, va_list *ap)
                 return NULL;
 
             if (ours)
-                return jsonp_stringn_nocheck_own(str, len);
+                return jsonp_stringn_nocheck_own(NULL, str, len);
             else
                 return json_stringn_nocheck(str, len);
         }
@@ -373,6 +373,7 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap)
 
     while(token(s) != '}') {
         const char *key;
+        size_t key_len, hash;
         json_t *value;
         int opt = 0;
 
@@ -403,6 +404,9 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap)
             set_error(s, "<args>", "NULL object key");
             goto out;
         }
+        /* Hash the key once for both the lookup and key_set */
+        key_len = strlen(key);
+        hash = hashtable_hash(key, key_len);
 
         next_token(s);
 
@@ -416,7 +420,8 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap)
             value = NULL;
         }
         else {
-            value = json_object_get(root, key);
+            value = hashtable_get_hashed(&json_to_object(root)->hashtable,
+                                         key, key_len, hash);
             if(!value && !opt) {
                 set_error(s, "<validation>", "Object item not found: %s", key);
                 goto out;
@@ -426,7 +431,7 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap)
         if(unpack(s, value, ap))
             goto out;
 
-        hashtable_set(&key_set, key, 0, json_null());
+        hashtable_set_hashed(&key_set, key, key_len, hash, json_null());
         next_token(s);
     }
 
@@ -436,12 +441,13 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap)
     if(root && strict == 1) {
         /* We need to check that all non optional items have been parsed */
         const char *key;
+        size_t key_len;
         json_t *value;
         long unpacked = 0;
         if (gotopt) {
             /* We have optional keys, we need to iter on each key */
-            json_object_foreach(root, key, value) {
-                if(!hashtable_get(&key_set, key)) {
+            json_object_keylen_foreach(root, key, key_len, value) {
+                if(!hashtable_get(&key_set, key, key_len)) {
                     unpacked++;
                 }
             }
@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2009-2014 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
+#include <string.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "jansson_private.h"
+#include "scan.h"
+#include "utf.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define SCAN_USE_SSE2 1
+
+#if HAVE_X86_INTRINSICS && HAVE_ATOMIC_BUILTINS
+#include <immintrin.h>
+#define SCAN_USE_AVX2 1
+#endif
+#endif
+
+/* A byte ends a run of plain string characters if it's '"', '\\' or
+   a control character */
+#define is_special(c) \
+    ((c) == '"' || (c) == '\\' || (unsigned char)(c) < 0x20)
+
+#define is_continuation(c)  (((unsigned char)(c) & 0xC0) == 0x80)
+
+static const char *scan_string_bytes(const char *str, const char *end)
+{
+    while(str < end && !is_special(*str))
+        str++;
+    return str;
+}
+
+/* Validate non-ASCII bytes starting at str[i] one sequence at a time,
+   up to the next ASCII byte. Returns the index of the first byte that
+   wasn't consumed, which is non-ASCII only if it starts an invalid
+   sequence. */
+static JSON_INLINE size_t scan_utf8_sequences(const char *str, size_t length,
+                                              size_t i)
+{
+    do {
+        size_t count = utf8_check_first(str[i]);
+        if(count == 0)
+            break;
+
+        if(count > 1) {
+            if(count > length - i || !utf8_check_full(&str[i], count, NULL))
+                break;
+        }
+
+        i += count;
+    } while(i < length && (unsigned char)str[i] >= 0x80);
+
+    return i;
+}
+
+/* Validate str[i..length) a byte or a sequence at a time */
+static size_t scan_utf8_bytes(const char *str, size_t length, size_t i)
+{
+    while(i < length)
+    {
+        if((unsigned char)str[i] < 0x80)
+            i++;
+        else {
+            size_t next = scan_utf8_sequences(str, length, i);
+            if(next < length && (unsigned char)str[next] >= 0x80)
+                return next;
+            i = next;
+        }
+    }
+
+    return i;
+}
+
+
+#ifndef SCAN_USE_SSE2
+
+/*** portable versions, one machine word at a time ***/
+
+#define ONES      ((uint64_t)0x0101010101010101ULL)
+#define HIGHBITS  ((uint64_t)0x8080808080808080ULL)
+
+/* Non-zero if any byte in x is zero */
+#define has_zero(x)  (((x) - ONES) & ~(x) & HIGHBITS)
+
+static const char *scan_string_word(const char *str, const char *end)
+{
+    while(end - str >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, str, 8);
+
+        /* Control characters are the bytes whose top three bits are
+           all zero */
+        if(has_zero(word & (0xE0 * ONES)) ||
+           has_zero(word ^ ('"' * ONES)) ||
+           has_zero(word ^ ('\\' * ONES)))
+            break;
+
+        str += 8;
+    }
+
+    return scan_string_bytes(str, end);
+}
+
+static size_t scan_utf8_word(const char *str, size_t length)
+{
+    size_t i = 0;
+
+    while(length - i >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, &str[i], 8);
+
+        if(!(word & HIGHBITS))
+            i += 8;
+        else if((unsigned char)str[i] < 0x80)
+            i++;
+        else {
+            size_t next = scan_utf8_sequences(str, length, i);
+            if(next < length && (unsigned char)str[next] >= 0x80)
+                return next;
+            i = next;
+        }
+    }
+
+    return scan_utf8_bytes(str, length, i);
+}
+
+#endif
+
+
+/*** SSE2 versions, 16 bytes at a time ***/
+
+#ifdef SCAN_USE_SSE2
+static const char *scan_string_sse2(const char *str, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    while(end - str >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)str);
+
+        /* min(c, 0x1F) == c only for control characters */
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                         _mm_cmpeq_epi8(chunk, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+
+        int mask = _mm_movemask_epi8(special);
+        if(mask)
+            return str + __builtin_ctz(mask);
+
+        str += 16;
+    }
+
+    return scan_string_bytes(str, end);
+}
+
+static size_t scan_utf8_sse2(const char *str, size_t length)
+{
+    size_t i = 0;
+
+    while(length - i >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)&str[i]);
+
+        if(!_mm_movemask_epi8(chunk))
+            i += 16;
+        else if((unsigned char)str[i] < 0x80)
+            i++;
+        else {
+            size_t next = scan_utf8_sequences(str, length, i);
+            if(next < length && (unsigned char)str[next] >= 0x80)
+                return next;
+            i = next;
+        }
+    }
+
+    return scan_utf8_bytes(str, length, i);
+}
+#endif
+
+
+/*** AVX2 and SSSE3 versions ***/
+
+#ifdef SCAN_USE_AVX2
+__attribute__((target("avx2")))
+static const char *scan_string_avx2(const char *str, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+
+    while(end - str >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)str);
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                            _mm256_cmpeq_epi8(chunk, backslash)),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control), chunk));
+
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(special);
+        if(mask)
+            return str + __builtin_ctz(mask);
+
+        str += 32;
+    }
+
+    return scan_string_sse2(str, end);
+}
+
+/*
+  The lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less
+  Than One Instruction Per Byte" (2021), 16 bytes at a time.
+
+  Each byte is classified by three table lookups: the high and low
+  nibbles of the previous byte and the high nibble of the byte itself.
+  Each table maps a nibble to the set of errors it's compatible with,
+  so an error bit survives ANDing the three lookups only if all of
+  them agree. The one thing two consecutive bytes can't tell, whether
+  a continuation after a continuation is the third or fourth byte of
+  a sequence, is checked by looking two and three bytes back.
+*/
+
+#define TOO_SHORT       (1 << 0)  /* lead byte without continuation */
+#define TOO_LONG        (1 << 1)  /* ASCII followed by continuation */
+#define OVERLONG_3      (1 << 2)  /* 0xE0 0x80..0x9F */
+#define TOO_LARGE       (1 << 3)  /* above U+10FFFF */
+#define SURROGATE       (1 << 4)  /* 0xED 0xA0..0xBF */
+#define OVERLONG_2      (1 << 5)  /* 0xC0 or 0xC1 */
+#define TOO_LARGE_1000  (1 << 6)  /* 0xF5.. 0x80..0x8F */
+#define OVERLONG_4      (1 << 6)  /* 0xF0 0x80..0x8F */
+#define TWO_CONTS       (1 << 7)  /* continuation after continuation */
+#define CARRY           (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static size_t scan_utf8_ssse3(const char *str, size_t length)
+{
+    const __m128i byte_1_high = _mm_setr_epi8(
+        /* 0xxx: ASCII */
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        /* 10xx: continuation */
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        /* 1100 */
+        TOO_SHORT | OVERLONG_2,
+        /* 1101 */
+        TOO_SHORT,
+        /* 1110 */
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        /* 1111 */
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+
+    const __m128i byte_1_low = _mm_setr_epi8(
+        /* 0000 */
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        /* 0001 */
+        CARRY | OVERLONG_2,
+        /* 001x */
+        CARRY,
+        CARRY,
+        /* 0100 */
+        CARRY | TOO_LARGE,
+        /* 0101 - 1100 */
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        /* 1101 */
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        /* 111x */
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000);
+
+    const __m128i byte_2_high = _mm_setr_epi8(
+        /* 0xxx: ASCII */
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        /* 1000 */
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        /* 1001 */
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        /* 101x */
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        /* 11xx: lead byte */
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+    /* Lead bytes in the last three positions that need bytes from the
+       next block saturate to non-zero */
+    const __m128i incomplete_max = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i prev = zero;
+    __m128i incomplete = zero;
+
+    /* All sequences before boundary are complete and valid */
+    size_t pos = 0, boundary = 0;
+
+    while(length - pos >= 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)&str[pos]);
+        __m128i prev1, prev2, prev3, special, must23, error;
+
+        if(!_mm_movemask_epi8(in)) {
+            /* All ASCII, which is an error only if the previous block
+               ended in the middle of a sequence */
+            if(_mm_movemask_epi8(_mm_cmpeq_epi8(incomplete, zero)) != 0xFFFF)
+                break;
+
+            prev = in;
+            pos += 16;
+            boundary = pos;
+            continue;
+        }
+
+        prev1 = _mm_alignr_epi8(in, prev, 15);
+        special = _mm_and_si128(
+            _mm_and_si128(
+                _mm_shuffle_epi8(byte_1_high,
+                                 _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+            _mm_shuffle_epi8(byte_2_high,
+                             _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+
+        prev2 = _mm_alignr_epi8(in, prev, 14);
+        prev3 = _mm_alignr_epi8(in, prev, 13);
+        must23 = _mm_cmpgt_epi8(
+            _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 1))),
+                         _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 1)))),
+            zero);
+
+        error = _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8((char)0x80)),
+                              special);
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xFFFF)
+            break;
+
+        incomplete = _mm_subs_epu8(in, incomplete_max);
+        prev = in;
+        pos += 16;
+
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(incomplete, zero)) != 0xFFFF) {
+            /* The last sequence is completed by the next block */
+            boundary = pos - 1;
+            while(is_continuation(str[boundary]))
+                boundary--;
+        }
+        else
+            boundary = pos;
+    }
+
+    /* Pinpoint the error, or check the tail that's shorter than a
+       block */
+    return scan_utf8_bytes(str, length, boundary);
+}
+#endif
+
+
+/*** runtime dispatch ***/
+
+#ifdef SCAN_USE_SSE2
+#define scan_string_default  scan_string_sse2
+#define scan_utf8_default    scan_utf8_sse2
+#else
+#define scan_string_default  scan_string_word
+#define scan_utf8_default    scan_utf8_word
+#endif
+
+#ifdef SCAN_USE_AVX2
+
+typedef const char *(*scan_string_func)(const char *str, const char *end);
+typedef size_t (*scan_utf8_func)(const char *str, size_t length);
+
+static const char *scan_string_resolve(const char *str, const char *end);
+static size_t scan_utf8_resolve(const char *str, size_t length);
+
+/* The pointers are resolved on first use. Racing threads all store
+   the same values, and the loads and stores are atomic so that no
+   thread sees a torn pointer. */
+static scan_string_func scan_string_impl = scan_string_resolve;
+static scan_utf8_func scan_utf8_impl = scan_utf8_resolve;
+
+#define impl_load(impl_)  __atomic_load_n(&(impl_), __ATOMIC_RELAXED)
+#define impl_store(impl_, value_) \
+    __atomic_store_n(&(impl_), (value_), __ATOMIC_RELAXED)
+
+static void scan_resolve(void)
+{
+    scan_string_func string_impl = scan_string_default;
+    scan_utf8_func utf8_impl = scan_utf8_default;
+
+    if(__builtin_cpu_supports("avx2"))
+        string_impl = scan_string_avx2;
+    if(__builtin_cpu_supports("ssse3"))
+        utf8_impl = scan_utf8_ssse3;
+
+    impl_store(scan_string_impl, string_impl);
+    impl_store(scan_utf8_impl, utf8_impl);
+}
+
+static const char *scan_string_resolve(const char *str, const char *end)
+{
+    scan_resolve();
+    return impl_load(scan_string_impl)(str, end);
+}
+
+static size_t scan_utf8_resolve(const char *str, size_t length)
+{
+    scan_resolve();
+    return impl_load(scan_utf8_impl)(str, length);
+}
+
+const char *scan_string(const char *str, const char *end)
+{
+    return impl_load(scan_string_impl)(str, end);
+}
+
+size_t scan_utf8(const char *str, size_t length)
+{
+    return impl_load(scan_utf8_impl)(str, length);
+}
+
+#else /* SCAN_USE_AVX2 */
+
+/* Without runtime CPU detection the choice is made at compile time */
+const char *scan_string(const char *str, const char *end)
+{
+    return scan_string_default(str, end);
+}
+
+size_t scan_utf8(const char *str, size_t length)
+{
+    return scan_utf8_default(str, length);
+}
+
+#endif /* SCAN_USE_AVX2 */
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2009-2014 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/* Return a pointer to the first byte in [str, end) that cannot be
+   copied verbatim out of a JSON string literal, i.e. '"', '\\' or a
+   control character. Returns end if there's no such byte. Non-ASCII
+   bytes are not checked; the caller must validate them as UTF-8.
+
+   The work is done 16 or 32 bytes at a time using SSE2 or AVX2 when
+   the CPU supports it, and a word at a time otherwise. */
+const char *scan_string(const char *str, const char *end);
+
+/* Return the length of the longest prefix of str that consists of
+   complete, valid UTF-8 sequences. The whole string is valid if the
+   result is length.
+
+   Runs of ASCII are skipped a word or 16 bytes at a time. When the
+   CPU supports SSSE3, other text is validated 16 bytes at a time
+   with table lookups. */
+size_t scan_utf8(const char *str, size_t length);
+
+#endif
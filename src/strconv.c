@@ -1,134 +1,904 @@
 #include <assert.h>
-#include <errno.h>
-#include <stdio.h>
+#include <float.h>
 #include <string.h>
 #include "jansson_private.h"
 #include "strbuffer.h"
 
-/* need jansson_private_config.h to get the correct snprintf */
 #ifdef HAVE_CONFIG_H
 #include <jansson_private_config.h>
 #endif
 
-#if JSON_HAVE_LOCALECONV
-#include <locale.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "pow10.h"
+#include "pow5.h"
+
+#define l_isdigit(c)  ('0' <= (c) && (c) <= '9')
+
+/*** decimal to binary conversion ***/
 
 /*
-  - This code assumes that the decimal separator is exactly one
-    character.
+  jsonp_strtod() converts the text of a JSON number to the nearest
+  double, without strtod() and the locale. The text has already been
+  validated by the lexer. There are three ways to get the result,
+  tried in order:
 
-  - If setlocale() is called by another thread between the call to
-    localeconv() and the call to sprintf() or strtod(), the result may
-    be wrong. setlocale() is not thread-safe and should not be used
-    this way. Multi-threaded programs should use uselocale() instead.
+  - If the first 19 significant digits are all there is and they fit
+    in 53 bits, and the power of ten is exact as a double, a single
+    multiplication or division is correctly rounded (Clinger 1990).
+
+  - Otherwise the digits are multiplied by a 128-bit approximation of
+    the power of ten. This almost always determines the result
+    (Lemire, "Number Parsing at a Gigabyte per Second", 2021).
+
+  - The remaining cases, i.e. results that are very close to halfway
+    between two doubles, subnormal or infinite, are handled exactly
+    by shifting an arbitrary precision decimal number in base 10
+    (as in the Go standard library's strconv).
 */
 
-static void to_locale(strbuffer_t *strbuffer)
+#define DOUBLE_MANTISSA_BITS  52
+#define DOUBLE_EXPONENT_BIAS  1023
+
+#define UINT64_MAX_DIGITS     19
+
+static JSON_INLINE int count_leading_zeros(uint64_t x)
 {
-    const char *point;
-    char *pos;
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while(!(x & ((uint64_t)1 << 63))) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
 
-    point = localeconv()->decimal_point;
-    if(*point == '.') {
-        /* No conversion needed */
-        return;
+/* Full 64 x 64 -> 128 bit multiplication */
+static JSON_INLINE void multiply_128(uint64_t a, uint64_t b,
+                                     uint64_t *hi, uint64_t *lo)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    *hi = (uint64_t)(product >> 64);
+    *lo = (uint64_t)product;
+#else
+    uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi;
+    uint64_t hl = a_hi * b_lo, hh = a_hi * b_hi;
+    uint64_t middle = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+
+    *hi = hh + (lh >> 32) + (hl >> 32) + (middle >> 32);
+    *lo = (middle << 32) | (ll & 0xFFFFFFFF);
+#endif
+}
+
+static JSON_INLINE double double_from_bits(uint64_t bits)
+{
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+/* Powers of ten that are exact as doubles */
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22
+};
+#endif
+
+/* Convert w * 10**exp10 to a double with the 128-bit approximation of
+   10**exp10. Returns -1 if the result can't be determined this way. */
+static int eisel_lemire(uint64_t w, int exp10, int negative, double *out)
+{
+    const uint64_t *pow10;
+    uint64_t hi, lo, mantissa, bits;
+    long scaled;
+    int exp2, shift, msb;
+
+    if(exp10 < POW10_MIN_EXP || exp10 > POW10_MAX_EXP)
+        return -1;
+
+    pow10 = pow10_table[exp10 - POW10_MIN_EXP];
+
+    shift = count_leading_zeros(w);
+    w <<= shift;
+
+    /* floor(log2(10) * exp10), (217706 / 65536) ~ log2(10) */
+    scaled = 217706L * exp10;
+    if(scaled >= 0)
+        exp2 = (int)(scaled / 65536);
+    else
+        exp2 = -(int)((-scaled + 65535) / 65536);
+    exp2 += 64 + DOUBLE_EXPONENT_BIAS - shift;
+
+    multiply_128(w, pow10[0], &hi, &lo);
+
+    /* If the low bits of the upper half are all ones, adding the
+       product with the lower half of the power of ten may carry into
+       the bits that matter */
+    if((hi & 0x1FF) == 0x1FF && lo + w < w) {
+        uint64_t hi2, lo2;
+
+        multiply_128(w, pow10[1], &hi2, &lo2);
+        lo += hi2;
+        if(lo < hi2)
+            hi++;
+
+        /* Still can't tell */
+        if((hi & 0x1FF) == 0x1FF && lo + 1 == 0 && lo2 + w < w)
+            return -1;
+    }
+
+    /* Keep 54 bits, one more than needed for rounding */
+    msb = (int)(hi >> 63);
+    mantissa = hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
+
+    /* Possibly exactly halfway between two doubles */
+    if(lo == 0 && (hi & 0x1FF) == 0 && (mantissa & 3) == 1)
+        return -1;
+
+    /* Round to 53 bits */
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if(mantissa >> (DOUBLE_MANTISSA_BITS + 1)) {
+        mantissa >>= 1;
+        exp2++;
+    }
+
+    /* Subnormal or infinite */
+    if(exp2 <= 0 || exp2 >= 0x7FF)
+        return -1;
+
+    bits = ((uint64_t)exp2 << DOUBLE_MANTISSA_BITS) |
+        (mantissa & (((uint64_t)1 << DOUBLE_MANTISSA_BITS) - 1));
+    if(negative)
+        bits |= (uint64_t)1 << 63;
+
+    *out = double_from_bits(bits);
+    return 0;
+}
+
+
+/* An arbitrary precision decimal number 0.d[0]d[1]...d[nd-1] * 10**dp.
+   Digits that don't fit in d are dropped; truncated is set if any of
+   them was non-zero. 800 digits is enough to tell which way any
+   number rounds, the halfway points between doubles having at most
+   767 significant digits. */
+
+#define DECIMAL_MAX_DIGITS  800
+
+/* The largest shift that can't overflow a 64-bit accumulator */
+#define DECIMAL_MAX_SHIFT   60
+
+typedef struct {
+    unsigned char d[DECIMAL_MAX_DIGITS];
+    int nd;
+    int dp;
+    int truncated;
+} decimal_t;
+
+static void decimal_trim(decimal_t *a)
+{
+    while(a->nd > 0 && a->d[a->nd - 1] == 0)
+        a->nd--;
+    if(a->nd == 0)
+        a->dp = 0;
+}
+
+static void decimal_init(decimal_t *a, const char *str)
+{
+    int exponent = 0, negative_exponent = 0;
+
+    a->nd = 0;
+    a->dp = 0;
+    a->truncated = 0;
+
+    if(*str == '-')
+        str++;
+
+    for(; l_isdigit(*str); str++) {
+        if(*str == '0' && a->nd == 0)
+            continue;
+        if(a->nd < DECIMAL_MAX_DIGITS)
+            a->d[a->nd++] = *str - '0';
+        else if(*str != '0')
+            a->truncated = 1;
+        a->dp++;
+    }
+
+    if(*str == '.') {
+        for(str++; l_isdigit(*str); str++) {
+            if(*str == '0' && a->nd == 0) {
+                a->dp--;
+                continue;
+            }
+            if(a->nd < DECIMAL_MAX_DIGITS)
+                a->d[a->nd++] = *str - '0';
+            else if(*str != '0')
+                a->truncated = 1;
+        }
+    }
+
+    if(*str == 'e' || *str == 'E') {
+        str++;
+        if(*str == '-') {
+            negative_exponent = 1;
+            str++;
+        }
+        else if(*str == '+')
+            str++;
+
+        /* Anything this large is zero or infinity anyway */
+        for(; l_isdigit(*str); str++) {
+            if(exponent < 100000)
+                exponent = exponent * 10 + (*str - '0');
+        }
+
+        a->dp += negative_exponent ? -exponent : exponent;
+    }
+
+    decimal_trim(a);
+}
+
+/* Divide by 2**k */
+static void decimal_shift_right(decimal_t *a, int k)
+{
+    const uint64_t mask = ((uint64_t)1 << k) - 1;
+    uint64_t n = 0;
+    int r = 0, w = 0;
+
+    /* Pick up enough leading digits to cover the first shift */
+    while(!(n >> k)) {
+        if(r < a->nd)
+            n = n * 10 + a->d[r];
+        else if(n == 0) {
+            a->nd = 0;
+            return;
+        }
+        else
+            n *= 10;
+        r++;
+    }
+    a->dp -= r - 1;
+
+    /* Pick up a digit, put down a digit */
+    for(; r < a->nd; r++) {
+        a->d[w++] = (unsigned char)(n >> k);
+        n = (n & mask) * 10 + a->d[r];
+    }
+
+    /* Put down the remaining digits */
+    while(n > 0) {
+        unsigned char digit = (unsigned char)(n >> k);
+        if(w < DECIMAL_MAX_DIGITS)
+            a->d[w++] = digit;
+        else if(digit > 0)
+            a->truncated = 1;
+        n = (n & mask) * 10;
     }
 
-    pos = strchr(strbuffer->value, '.');
-    if(pos)
-        *pos = *point;
+    a->nd = w;
+    decimal_trim(a);
 }
 
-static void from_locale(char *buffer)
+/* Multiply by 2**k */
+static void decimal_shift_left(decimal_t *a, int k)
 {
-    const char *point;
-    char *pos;
+    /* Digits are produced from the least significant end */
+    unsigned char digits[DECIMAL_MAX_DIGITS + 20];
+    int w = (int)sizeof(digits), r, nd;
+    uint64_t n = 0;
 
-    point = localeconv()->decimal_point;
-    if(*point == '.') {
-        /* No conversion needed */
+    for(r = a->nd - 1; r >= 0; r--) {
+        n += (uint64_t)a->d[r] << k;
+        digits[--w] = (unsigned char)(n % 10);
+        n /= 10;
+    }
+    while(n > 0) {
+        digits[--w] = (unsigned char)(n % 10);
+        n /= 10;
+    }
+
+    nd = (int)sizeof(digits) - w;
+    a->dp += nd - a->nd;
+
+    if(nd > DECIMAL_MAX_DIGITS) {
+        for(r = w + DECIMAL_MAX_DIGITS; r < (int)sizeof(digits); r++) {
+            if(digits[r])
+                a->truncated = 1;
+        }
+        nd = DECIMAL_MAX_DIGITS;
+    }
+
+    memcpy(a->d, &digits[w], nd);
+    a->nd = nd;
+    decimal_trim(a);
+}
+
+static void decimal_shift(decimal_t *a, int k)
+{
+    if(a->nd == 0)
         return;
+
+    while(k > DECIMAL_MAX_SHIFT) {
+        decimal_shift_left(a, DECIMAL_MAX_SHIFT);
+        k -= DECIMAL_MAX_SHIFT;
+    }
+    while(k < -DECIMAL_MAX_SHIFT) {
+        decimal_shift_right(a, DECIMAL_MAX_SHIFT);
+        k += DECIMAL_MAX_SHIFT;
     }
 
-    pos = strchr(buffer, *point);
-    if(pos)
-        *pos = '.';
+    if(k > 0)
+        decimal_shift_left(a, k);
+    else if(k < 0)
+        decimal_shift_right(a, -k);
+}
+
+/* Would cutting a at nd digits have to round up? */
+static int decimal_round_up(const decimal_t *a, int nd)
+{
+    if(nd < 0 || nd >= a->nd)
+        return 0;
+
+    if(a->d[nd] == 5 && nd + 1 == a->nd) {
+        /* Exactly halfway, unless digits were dropped. Round to
+           even. */
+        if(a->truncated)
+            return 1;
+        return nd > 0 && a->d[nd - 1] % 2 == 1;
+    }
+
+    return a->d[nd] >= 5;
+}
+
+/* The integer part of a, rounded. a must be smaller than 2**64. */
+static uint64_t decimal_rounded_integer(const decimal_t *a)
+{
+    uint64_t n = 0;
+    int i;
+
+    for(i = 0; i < a->dp && i < a->nd; i++)
+        n = n * 10 + a->d[i];
+    for(; i < a->dp; i++)
+        n *= 10;
+
+    if(decimal_round_up(a, a->dp))
+        n++;
+
+    return n;
+}
+
+/* Binary exponents to shift by to remove a given number of decimal
+   digits from the integer part */
+static const int decimal_powtab[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+
+#define DECIMAL_POWTAB_SIZE \
+    ((int)(sizeof(decimal_powtab) / sizeof(decimal_powtab[0])))
+
+/* Convert a to the bits of the nearest double. Returns -1 on
+   overflow. */
+static int decimal_to_bits(decimal_t *a, uint64_t *bits)
+{
+    const int min_exp = 1 - DOUBLE_EXPONENT_BIAS;
+    uint64_t mantissa;
+    int exp2 = 0;
+
+    if(a->nd == 0 || a->dp < -330) {
+        *bits = 0;
+        return 0;
+    }
+
+    if(a->dp > 310)
+        return -1;
+
+    /* Scale by powers of two until the value is in [0.5, 1) */
+    while(a->dp > 0) {
+        int n = a->dp >= DECIMAL_POWTAB_SIZE ? 27 : decimal_powtab[a->dp];
+        decimal_shift(a, -n);
+        exp2 += n;
+    }
+    while(a->dp < 0 || (a->dp == 0 && a->d[0] < 5)) {
+        int n = -a->dp >= DECIMAL_POWTAB_SIZE ? 27 : decimal_powtab[-a->dp];
+        decimal_shift(a, n);
+        exp2 -= n;
+    }
+
+    /* The mantissa of a double is in [1, 2) */
+    exp2--;
+
+    /* Subnormal numbers have fewer bits of precision */
+    if(exp2 < min_exp) {
+        decimal_shift(a, exp2 - min_exp);
+        exp2 = min_exp;
+    }
+
+    if(exp2 + DOUBLE_EXPONENT_BIAS >= 0x7FF)
+        return -1;
+
+    decimal_shift(a, DOUBLE_MANTISSA_BITS + 1);
+    mantissa = decimal_rounded_integer(a);
+
+    /* Rounding may have carried into a new bit */
+    if(mantissa == (uint64_t)2 << DOUBLE_MANTISSA_BITS) {
+        mantissa >>= 1;
+        exp2++;
+        if(exp2 + DOUBLE_EXPONENT_BIAS >= 0x7FF)
+            return -1;
+    }
+
+    /* The biased exponent of subnormal numbers is 0 */
+    if(!(mantissa & ((uint64_t)1 << DOUBLE_MANTISSA_BITS)))
+        exp2 = -DOUBLE_EXPONENT_BIAS;
+
+    *bits = ((uint64_t)(exp2 + DOUBLE_EXPONENT_BIAS) << DOUBLE_MANTISSA_BITS) |
+        (mantissa & (((uint64_t)1 << DOUBLE_MANTISSA_BITS) - 1));
+    return 0;
 }
-#endif
 
 int jsonp_strtod(strbuffer_t *strbuffer, double *out)
 {
+    const char *str = strbuffer->value;
+    uint64_t w = 0, bits;
+    int negative = 0, digits = 0, truncated = 0;
+    int exp10 = 0, exponent = 0, negative_exponent = 0;
+    decimal_t decimal;
     double value;
-    char *end;
 
-#if JSON_HAVE_LOCALECONV
-    to_locale(strbuffer);
-#endif
+    /* Collect the first 19 significant digits in w, so that the value
+       is w * 10**exp10, plus the dropped digits */
+    if(*str == '-') {
+        negative = 1;
+        str++;
+    }
+
+    for(; l_isdigit(*str); str++) {
+        if(digits < UINT64_MAX_DIGITS) {
+            w = w * 10 + (*str - '0');
+            if(w)
+                digits++;
+        }
+        else {
+            exp10++;
+            if(*str != '0')
+                truncated = 1;
+        }
+    }
+
+    if(*str == '.') {
+        for(str++; l_isdigit(*str); str++) {
+            if(digits < UINT64_MAX_DIGITS) {
+                w = w * 10 + (*str - '0');
+                if(w)
+                    digits++;
+                exp10--;
+            }
+            else if(*str != '0')
+                truncated = 1;
+        }
+    }
+
+    if(*str == 'e' || *str == 'E') {
+        str++;
+        if(*str == '-') {
+            negative_exponent = 1;
+            str++;
+        }
+        else if(*str == '+')
+            str++;
+
+        for(; l_isdigit(*str); str++) {
+            if(exponent < 100000)
+                exponent = exponent * 10 + (*str - '0');
+        }
+
+        exp10 += negative_exponent ? -exponent : exponent;
+    }
+
+    assert(str == strbuffer->value + strbuffer->length);
 
-    errno = 0;
-    value = strtod(strbuffer->value, &end);
-    assert(end == strbuffer->value + strbuffer->length);
+    if(w == 0) {
+        value = 0.0;
+        goto out;
+    }
 
-    if(errno == ERANGE && value != 0) {
-        /* Overflow */
+    /* w >= 1, so this overflows */
+    if(exp10 > POW10_MAX_EXP)
         return -1;
+
+    /* w < 10**19, so this is below half of the smallest subnormal */
+    if(exp10 < POW10_MIN_EXP) {
+        value = 0.0;
+        goto out;
+    }
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    if(!truncated && w <= (uint64_t)1 << 53 && -22 <= exp10 && exp10 <= 22)
+    {
+        value = (double)w;
+        if(exp10 < 0)
+            value /= exact_pow10[-exp10];
+        else
+            value *= exact_pow10[exp10];
+        goto out;
+    }
+#endif
+
+    if(eisel_lemire(w, exp10, 0, &value) == 0) {
+        double upper;
+
+        /* With dropped digits, the value is between w and w + 1 times
+           the power of ten */
+        if(!truncated ||
+           (eisel_lemire(w + 1, exp10, 0, &upper) == 0 && upper == value))
+            goto out;
     }
 
-    *out = value;
+    decimal_init(&decimal, strbuffer->value);
+    if(decimal_to_bits(&decimal, &bits))
+        return -1;
+    value = double_from_bits(bits);
+
+out:
+    *out = negative ? -value : value;
     return 0;
 }
 
+
+/*** binary to decimal conversion ***/
+
+/*
+  jsonp_dtostr() writes the shortest decimal number that converts back
+  to the same double, using the Ryu algorithm (Adams, "Ryū: Fast
+  Float-to-String Conversion", 2018). The decimal representation
+  is computed with integer arithmetic only, so it doesn't depend on
+  the locale or the C library.
+*/
+
+/* ceil(log2(5**e)), or 1 for e == 0. Valid for 0 <= e <= 3528. */
+static JSON_INLINE int pow5_bits(int e)
+{
+    return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2**e)) for 0 <= e <= 1650 */
+static JSON_INLINE int log10_pow2(int e)
+{
+    return (int)(((uint32_t)e * 78913) >> 18);
+}
+
+/* floor(log10(5**e)) for 0 <= e <= 2620 */
+static JSON_INLINE int log10_pow5(int e)
+{
+    return (int)(((uint32_t)e * 732923) >> 20);
+}
+
+static JSON_INLINE int multiple_of_pow5(uint64_t value, int p)
+{
+    int count = 0;
+
+    while(value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+
+    return count >= p;
+}
+
+static JSON_INLINE int multiple_of_pow2(uint64_t value, int p)
+{
+    return (value & (((uint64_t)1 << p) - 1)) == 0;
+}
+
+/* (m * mul) >> j, where mul is a 128-bit number as {low, high} and
+   64 < j < 128 */
+static JSON_INLINE uint64_t mul_shift_64(uint64_t m, const uint64_t *mul,
+                                         int j)
+{
+    uint64_t hi0, lo0, hi1, lo1;
+
+    multiply_128(m, mul[0], &hi0, &lo0);
+    multiply_128(m, mul[1], &hi1, &lo1);
+
+    lo1 += hi0;
+    if(lo1 < hi0)
+        hi1++;
+
+    j -= 64;
+    return (hi1 << (64 - j)) | (lo1 >> j);
+}
+
+/* Find the shortest decimal mantissa * 10**exponent that converts back
+   to the finite, non-zero double with the given bits */
+static void ryu(uint64_t bits, uint64_t *mantissa, int *exponent)
+{
+    uint64_t ieee_mantissa = bits & (((uint64_t)1 << DOUBLE_MANTISSA_BITS) - 1);
+    int ieee_exponent = (int)((bits >> DOUBLE_MANTISSA_BITS) & 0x7FF);
+
+    uint64_t m2, mv, vr, vp, vm, output;
+    int e2, e10, mm_shift, accept_bounds;
+    int vm_trailing_zeros = 0, vr_trailing_zeros = 0;
+    int removed = 0, last_removed = 0;
+
+    /* Two extra bits for computing the bounds of the interval that
+       converts back to the same double */
+    if(ieee_exponent == 0) {
+        e2 = 1 - DOUBLE_EXPONENT_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    }
+    else {
+        e2 = ieee_exponent - DOUBLE_EXPONENT_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = ((uint64_t)1 << DOUBLE_MANTISSA_BITS) | ieee_mantissa;
+    }
+
+    /* The bounds are included when the mantissa is even, because
+       ties round to even */
+    accept_bounds = (m2 & 1) == 0;
+
+    /* The interval is [4 * m2 - 1 - mm_shift, 4 * m2 + 2] * 2**e2. The
+       lower bound is closer at powers of two. */
+    mv = 4 * m2;
+    mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    /* Convert the interval to a power of ten */
+    if(e2 >= 0) {
+        int q = log10_pow2(e2) - (e2 > 3);
+        int k = POW5_INV_BITCOUNT + pow5_bits(q) - 1;
+        int i = -e2 + q + k;
+
+        e10 = q;
+        vr = mul_shift_64(4 * m2, pow5_inv_table[q], i);
+        vp = mul_shift_64(4 * m2 + 2, pow5_inv_table[q], i);
+        vm = mul_shift_64(4 * m2 - 1 - mm_shift, pow5_inv_table[q], i);
+
+        if(q <= 21) {
+            /* Only one of mp, mv and mm can be a multiple of 5 */
+            if(mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if(accept_bounds)
+                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            else
+                vp -= multiple_of_pow5(mv + 2, q);
+        }
+    }
+    else {
+        int q = log10_pow5(-e2) - (-e2 > 1);
+        int i = -e2 - q;
+        int k = pow5_bits(i) - POW5_BITCOUNT;
+        int j = q - k;
+
+        e10 = q + e2;
+        vr = mul_shift_64(4 * m2, pow5_table[i], j);
+        vp = mul_shift_64(4 * m2 + 2, pow5_table[i], j);
+        vm = mul_shift_64(4 * m2 - 1 - mm_shift, pow5_table[i], j);
+
+        if(q <= 1) {
+            /* mv = 4 * m2 always has at least two trailing zero bits */
+            vr_trailing_zeros = 1;
+            if(accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                vp--;
+        }
+        else if(q < 63) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* Remove digits while the interval still contains a number with
+       fewer digits */
+    if(vm_trailing_zeros || vr_trailing_zeros) {
+        /* The exact value may be halfway between two candidates */
+        while(vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (int)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+
+        if(vm_trailing_zeros) {
+            while(vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (int)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+
+        /* Round to even if the exact number is ...50..0 */
+        if(vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+            last_removed = 4;
+
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                       last_removed >= 5);
+    }
+    else {
+        /* The common case */
+        int round_up = 0;
+
+        if(vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+
+        while(vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+
+        output = vr + (vr == vm || round_up);
+    }
+
+    *mantissa = output;
+    *exponent = e10 + removed;
+}
+
+/* The longest output is "-0.0000" followed by 17 digits */
+#define DTOSTR_MAX_LENGTH  24
+
 int jsonp_dtostr(char *buffer, size_t size, double value)
 {
-    int ret;
-    char *start, *end;
+    char result[DTOSTR_MAX_LENGTH + 1];
+    char digits[20];
+    char *p = result;
+    uint64_t bits, mantissa;
+    int exponent, ndigits, point, i;
     size_t length;
 
-    ret = snprintf(buffer, size, "%.17g", value);
-    if(ret < 0)
-        return -1;
+    memcpy(&bits, &value, sizeof(bits));
 
-    length = (size_t)ret;
-    if(length >= size)
+    /* Infinity and NaN can't be represented in JSON */
+    if(((bits >> DOUBLE_MANTISSA_BITS) & 0x7FF) == 0x7FF)
         return -1;
 
-#if JSON_HAVE_LOCALECONV
-    from_locale(buffer);
-#endif
+    if(bits >> 63)
+        *p++ = '-';
 
-    /* Make sure there's a dot or 'e' in the output. Otherwise
-       a real is converted to an integer when decoding */
-    if(strchr(buffer, '.') == NULL &&
-       strchr(buffer, 'e') == NULL)
-    {
-        if(length + 3 >= size) {
-            /* No space to append ".0" */
-            return -1;
-        }
-        buffer[length] = '.';
-        buffer[length + 1] = '0';
-        buffer[length + 2] = '\0';
-        length += 2;
+    if((bits << 1) == 0) {
+        memcpy(p, "0.0", 3);
+        p += 3;
+        goto out;
     }
 
-    /* Remove leading '+' from positive exponent. Also remove leading
-       zeros from exponents (added by some printf() implementations) */
-    start = strchr(buffer, 'e');
-    if(start) {
-        start++;
-        end = start + 1;
+    ryu(bits, &mantissa, &exponent);
 
-        if(*start == '-')
-            start++;
+    ndigits = 0;
+    do {
+        digits[ndigits++] = (char)('0' + mantissa % 10);
+        mantissa /= 10;
+    } while(mantissa);
 
-        while(*end == '0')
-            end++;
+    /* The value is 0.<digits> * 10**point */
+    point = ndigits + exponent;
 
-        if(end != start) {
-            memmove(start, end, length - (size_t)(end - buffer));
-            length -= (size_t)(end - start);
+    if(point < -3 || point > 17) {
+        /* d.ddde<point - 1>, like "%.17g" */
+        *p++ = digits[--ndigits];
+        if(ndigits) {
+            *p++ = '.';
+            while(ndigits)
+                *p++ = digits[--ndigits];
+        }
+
+        *p++ = 'e';
+        exponent = point - 1;
+        if(exponent < 0) {
+            *p++ = '-';
+            exponent = -exponent;
+        }
+        if(exponent >= 100)
+            *p++ = (char)('0' + exponent / 100);
+        if(exponent >= 10)
+            *p++ = (char)('0' + exponent / 10 % 10);
+        *p++ = (char)('0' + exponent % 10);
+    }
+    else if(point <= 0) {
+        /* 0.000ddd */
+        *p++ = '0';
+        *p++ = '.';
+        for(i = point; i < 0; i++)
+            *p++ = '0';
+        while(ndigits)
+            *p++ = digits[--ndigits];
+    }
+    else {
+        /* ddd.ddd, or ddd000.0. There's always a dot, or the real
+           would be decoded as an integer. */
+        for(i = 0; i < point; i++)
+            *p++ = i < ndigits ? digits[ndigits - 1 - i] : '0';
+        *p++ = '.';
+        if(ndigits > point) {
+            for(i = point; i < ndigits; i++)
+                *p++ = digits[ndigits - 1 - i];
         }
+        else
+            *p++ = '0';
     }
 
+out:
+    length = (size_t)(p - result);
+    if(length >= size)
+        return -1;
+
+    memcpy(buffer, result, length);
+    buffer[length] = '\0';
+    return (int)length;
+}
+
+
+/*** integer to decimal conversion ***/
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* The longest output is a sign and 20 digits */
+#define ITOSTR_MAX_LENGTH  21
+
+int jsonp_itostr(char *buffer, size_t size, json_int_t value)
+{
+    char result[ITOSTR_MAX_LENGTH];
+    char *p = result + sizeof(result);
+    uint64_t magnitude;
+    size_t length;
+
+    /* Unsigned negation works for the most negative value, too */
+    magnitude = (uint64_t)value;
+    if(value < 0)
+        magnitude = 0 - magnitude;
+
+    /* Two digits at a time, from the least significant end */
+    while(magnitude >= 100) {
+        const char *pair = &digit_pairs[(magnitude % 100) * 2];
+        magnitude /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+
+    if(magnitude >= 10) {
+        const char *pair = &digit_pairs[magnitude * 2];
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    else
+        *--p = (char)('0' + magnitude);
+
+    if(value < 0)
+        *--p = '-';
+
+    length = (size_t)(result + sizeof(result) - p);
+    if(length >= size)
+        return -1;
+
+    memcpy(buffer, p, length);
+    buffer[length] = '\0';
     return (int)length;
 }
@@ -7,6 +7,7 @@
 
 #include <string.h>
 #include "utf.h"
+#include "scan.h"
 
 int utf8_encode(int32_t codepoint, char *buffer, size_t *size)
 {
@@ -164,24 +165,5 @@ const char *utf8_iterate(const char *buffer, size_t bufsize, int32_t *codepoint)
 
 int utf8_check_string(const char *string, size_t length)
 {
-    size_t i;
-
-    for(i = 0; i < length; i++)
-    {
-        size_t count = utf8_check_first(string[i]);
-        if(count == 0)
-            return 0;
-        else if(count > 1)
-        {
-            if(count > length - i)
-                return 0;
-
-            if(!utf8_check_full(&string[i], count, NULL))
-                return 0;
-
-            i += count - 1;
-        }
-    }
-
-    return 1;
+    return scan_utf8(string, length) == length;
 }
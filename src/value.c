@@ -35,10 +35,22 @@ static JSON_INLINE int isnan(double x) { return x != x; }
 static JSON_INLINE int isinf(double x) { return !isnan(x) && isnan(x - x); }
 #endif
 
-static JSON_INLINE void json_init(json_t *json, json_type type)
+/* Values allocated from an arena are released with the arena, so
+   reference counting doesn't apply to them */
+static JSON_INLINE void json_init(json_t *json, json_type type,
+                                  json_arena_t *arena)
 {
     json->type = type;
-    json->refcount = 1;
+    json->refcount = arena ? (size_t)-1 : 1;
+}
+
+/* A container in an arena is never deleted, so it can't own a value
+   that needs to be freed. It may only hold values from an arena and
+   true, false and null. Values don't record which arena they're in,
+   so values from another arena are accepted too. */
+static JSON_INLINE int arena_rejects(json_arena_t *arena, json_t *value)
+{
+    return arena && value->refcount != (size_t)-1;
 }
 
 
@@ -48,7 +60,12 @@ extern volatile uint32_t hashtable_seed;
 
 json_t *json_object(void)
 {
-    json_object_t *object = jsonp_malloc(sizeof(json_object_t));
+    return json_arena_object(NULL);
+}
+
+json_t *json_arena_object(json_arena_t *arena)
+{
+    json_object_t *object = jsonp_node_malloc(arena, sizeof(json_object_t));
     if(!object)
         return NULL;
 
@@ -57,24 +74,50 @@ json_t *json_object(void)
         json_object_seed(0);
     }
 
-    json_init(&object->json, JSON_OBJECT);
+    json_init(&object->json, JSON_OBJECT, arena);
 
     if(hashtable_init(&object->hashtable))
     {
-        jsonp_free(object);
+        jsonp_node_free(arena, object, sizeof(json_object_t));
         return NULL;
     }
 
-    object->serial = 0;
+    object->hashtable.arena = arena;
+    object->sorted = NULL;
     object->visited = 0;
 
     return &object->json;
 }
 
+json_t *json_object_sized(size_t size)
+{
+    json_t *json = json_object();
+
+    if(json && json_object_reserve(json, size))
+    {
+        json_decref(json);
+        return NULL;
+    }
+
+    return json;
+}
+
+/* The encoder caches the sorted order of keys for JSON_SORT_KEYS. It
+   must be dropped whenever keys are added or removed. */
+static void json_object_drop_sorted(json_object_t *object)
+{
+    if(object->sorted)
+    {
+        jsonp_arena_free(object->hashtable.arena, object->sorted);
+        object->sorted = NULL;
+    }
+}
+
 static void json_delete_object(json_object_t *object)
 {
+    json_object_drop_sorted(object);
     hashtable_close(&object->hashtable);
-    jsonp_free(object);
+    jsonp_node_free(NULL, object, sizeof(json_object_t));
 }
 
 size_t json_object_size(const json_t *json)
@@ -89,6 +132,14 @@ size_t json_object_size(const json_t *json)
 }
 
 json_t *json_object_get(const json_t *json, const char *key)
+{
+    if(!key)
+        return NULL;
+
+    return json_object_getn(json, key, strlen(key));
+}
+
+json_t *json_object_getn(const json_t *json, const char *key, size_t key_len)
 {
     json_object_t *object;
 
@@ -96,12 +147,25 @@ json_t *json_object_get(const json_t *json, const char *key)
         return NULL;
 
     object = json_to_object(json);
-    return hashtable_get(&object->hashtable, key);
+    return hashtable_get(&object->hashtable, key, key_len);
 }
 
 int json_object_set_new_nocheck(json_t *json, const char *key, json_t *value)
+{
+    if(!key)
+    {
+        json_decref(value);
+        return -1;
+    }
+
+    return json_object_setn_new_nocheck(json, key, strlen(key), value);
+}
+
+int json_object_setn_new_nocheck(json_t *json, const char *key, size_t key_len,
+                                 json_t *value)
 {
     json_object_t *object;
+    size_t size;
 
     if(!value)
         return -1;
@@ -112,28 +176,58 @@ int json_object_set_new_nocheck(json_t *json, const char *key, json_t *value)
         return -1;
     }
     object = json_to_object(json);
+    if(arena_rejects(object->hashtable.arena, value))
+    {
+        json_decref(value);
+        return -1;
+    }
+    size = object->hashtable.size;
 
-    if(hashtable_set(&object->hashtable, key, object->serial++, value))
+    if(hashtable_set(&object->hashtable, key, key_len, value))
     {
         json_decref(value);
         return -1;
     }
 
+    /* Replacing a value keeps the key in place */
+    if(object->hashtable.size != size)
+        json_object_drop_sorted(object);
+
     return 0;
 }
 
 int json_object_set_new(json_t *json, const char *key, json_t *value)
 {
-    if(!key || !utf8_check_string(key, strlen(key)))
+    if(!key)
+    {
+        json_decref(value);
+        return -1;
+    }
+
+    return json_object_setn_new(json, key, strlen(key), value);
+}
+
+int json_object_setn_new(json_t *json, const char *key, size_t key_len,
+                         json_t *value)
+{
+    if(!key || !utf8_check_string(key, key_len))
     {
         json_decref(value);
         return -1;
     }
 
-    return json_object_set_new_nocheck(json, key, value);
+    return json_object_setn_new_nocheck(json, key, key_len, value);
 }
 
 int json_object_del(json_t *json, const char *key)
+{
+    if(!key)
+        return -1;
+
+    return json_object_deln(json, key, strlen(key));
+}
+
+int json_object_deln(json_t *json, const char *key, size_t key_len)
 {
     json_object_t *object;
 
@@ -141,7 +235,11 @@ int json_object_del(json_t *json, const char *key)
         return -1;
 
     object = json_to_object(json);
-    return hashtable_del(&object->hashtable, key);
+    if(hashtable_del(&object->hashtable, key, key_len))
+        return -1;
+
+    json_object_drop_sorted(object);
+    return 0;
 }
 
 int json_object_clear(json_t *json)
@@ -153,22 +251,46 @@ int json_object_clear(json_t *json)
 
     object = json_to_object(json);
 
+    json_object_drop_sorted(object);
     hashtable_clear(&object->hashtable);
-    object->serial = 0;
 
     return 0;
 }
 
+int json_object_reserve(json_t *json, size_t size)
+{
+    json_object_t *object;
+
+    if(!json_is_object(json))
+        return -1;
+
+    object = json_to_object(json);
+    return hashtable_reserve(&object->hashtable, size);
+}
+
+int json_object_shrink(json_t *json)
+{
+    json_object_t *object;
+
+    if(!json_is_object(json))
+        return -1;
+
+    object = json_to_object(json);
+    json_object_drop_sorted(object);
+    return hashtable_shrink(&object->hashtable);
+}
+
 int json_object_update(json_t *object, json_t *other)
 {
     const char *key;
+    size_t key_len;
     json_t *value;
 
     if(!json_is_object(object) || !json_is_object(other))
         return -1;
 
-    json_object_foreach(other, key, value) {
-        if(json_object_set_nocheck(object, key, value))
+    json_object_keylen_foreach(other, key, key_len, value) {
+        if(json_object_setn_nocheck(object, key, key_len, value))
             return -1;
     }
 
@@ -178,14 +300,15 @@ int json_object_update(json_t *object, json_t *other)
 int json_object_update_existing(json_t *object, json_t *other)
 {
     const char *key;
+    size_t key_len;
     json_t *value;
 
     if(!json_is_object(object) || !json_is_object(other))
         return -1;
 
-    json_object_foreach(other, key, value) {
-        if(json_object_get(object, key))
-            json_object_set_nocheck(object, key, value);
+    json_object_keylen_foreach(other, key, key_len, value) {
+        if(json_object_getn(object, key, key_len))
+            json_object_setn_nocheck(object, key, key_len, value);
     }
 
     return 0;
@@ -194,14 +317,15 @@ int json_object_update_existing(json_t *object, json_t *other)
 int json_object_update_missing(json_t *object, json_t *other)
 {
     const char *key;
+    size_t key_len;
     json_t *value;
 
     if(!json_is_object(object) || !json_is_object(other))
         return -1;
 
-    json_object_foreach(other, key, value) {
-        if(!json_object_get(object, key))
-            json_object_set_nocheck(object, key, value);
+    json_object_keylen_foreach(other, key, key_len, value) {
+        if(!json_object_getn(object, key, key_len))
+            json_object_setn_nocheck(object, key, key_len, value);
     }
 
     return 0;
@@ -226,7 +350,7 @@ void *json_object_iter_at(json_t *json, const char *key)
         return NULL;
 
     object = json_to_object(json);
-    return hashtable_iter_at(&object->hashtable, key);
+    return hashtable_iter_at(&object->hashtable, key, strlen(key));
 }
 
 void *json_object_iter_next(json_t *json, void *iter)
@@ -248,6 +372,14 @@ const char *json_object_iter_key(void *iter)
     return hashtable_iter_key(iter);
 }
 
+size_t json_object_iter_key_len(void *iter)
+{
+    if(!iter)
+        return 0;
+
+    return hashtable_iter_key_len(iter);
+}
+
 json_t *json_object_iter_value(void *iter)
 {
     if(!iter)
@@ -261,6 +393,12 @@ int json_object_iter_set_new(json_t *json, void *iter, json_t *value)
     if(!json_is_object(json) || !iter || !value)
         return -1;
 
+    if(arena_rejects(json_to_object(json)->hashtable.arena, value))
+    {
+        json_decref(value);
+        return -1;
+    }
+
     hashtable_iter_set(iter, value);
     return 0;
 }
@@ -273,16 +411,66 @@ void *json_object_key_to_iter(const char *key)
     return hashtable_key_to_iter(key);
 }
 
+json_key_t *json_key_make(const char *key)
+{
+    if(!key)
+        return NULL;
+
+    return json_key_maken(key, strlen(key));
+}
+
+json_key_t *json_key_maken(const char *key, size_t key_len)
+{
+    json_key_t *result;
+
+    if(!key || key_len >= (size_t)-1 - offsetof(json_key_t, key))
+        return NULL;
+
+    /* The hash depends on the seed, so it must be fixed first */
+    if (!hashtable_seed)
+        json_object_seed(0);
+
+    result = jsonp_malloc(offsetof(json_key_t, key) + key_len + 1);
+    if(!result)
+        return NULL;
+
+    result->hash = hashtable_hash(key, key_len);
+    result->len = key_len;
+    memcpy(result->key, key, key_len);
+    result->key[key_len] = '\0';
+
+    return result;
+}
+
+void json_key_free(json_key_t *key)
+{
+    if(key)
+        jsonp_free(key);
+}
+
+json_t *json_object_get_by_key(const json_t *json, const json_key_t *key)
+{
+    json_object_t *object;
+
+    if(!key || !json_is_object(json))
+        return NULL;
+
+    object = json_to_object(json);
+    return hashtable_get_hashed(&object->hashtable, key->key, key->len,
+                                key->hash);
+}
+
 static int json_object_equal(json_t *object1, json_t *object2)
 {
     const char *key;
+    size_t key_len;
     json_t *value1, *value2;
 
     if(json_object_size(object1) != json_object_size(object2))
         return 0;
 
-    json_object_foreach(object1, key, value1) {
-        value2 = json_object_get(object2, key);
+    json_object_keylen_foreach(object1, key, key_len, value1) {
+        value2 = json_object_getn(object2, key, key_len);
 
         if(!json_equal(value1, value2))
             return 0;
@@ -296,14 +484,15 @@ static json_t *json_object_copy(json_t *object)
     json_t *result;
 
     const char *key;
+    size_t key_len;
     json_t *value;
 
-    result = json_object();
+    result = json_object_sized(json_object_size(object));
     if(!result)
         return NULL;
 
-    json_object_foreach(object, key, value)
-        json_object_set_nocheck(result, key, value);
+    json_object_keylen_foreach(object, key, key_len, value)
+        json_object_setn_nocheck(result, key, key_len, value);
 
     return result;
 }
@@ -313,7 +502,7 @@ static json_t *json_object_deep_copy(const json_t *object)
     json_t *result;
     void *iter;
 
-    result = json_object();
+    result = json_object_sized(json_object_size(object));
     if(!result)
         return NULL;
 
@@ -322,11 +511,13 @@ static json_t *json_object_deep_copy(const json_t *object)
     iter = json_object_iter((json_t *)object);
     while(iter) {
         const char *key;
+        size_t key_len;
         const json_t *value;
         key = json_object_iter_key(iter);
+        key_len = json_object_iter_key_len(iter);
         value = json_object_iter_value(iter);
 
-        json_object_set_new_nocheck(result, key, json_deep_copy(value));
+        json_object_setn_new_nocheck(result, key, key_len, json_deep_copy(value));
         iter = json_object_iter_next((json_t *)object, iter);
     }
 
@@ -336,19 +527,27 @@ static json_t *json_object_deep_copy(const json_t *object)
 
 /*** array ***/
 
-json_t *json_array(void)
+static json_t *array_create(json_arena_t *arena, size_t size)
 {
-    json_array_t *array = jsonp_malloc(sizeof(json_array_t));
+    json_array_t *array;
+
+    if(size == 0)
+        size = 1;
+    if(size > (size_t)-1 / sizeof(json_t *))
+        return NULL;
+
+    array = jsonp_node_malloc(arena, sizeof(json_array_t));
     if(!array)
         return NULL;
-    json_init(&array->json, JSON_ARRAY);
+    json_init(&array->json, JSON_ARRAY, arena);
 
+    array->arena = arena;
     array->entries = 0;
-    array->size = 8;
+    array->size = size;
 
-    array->table = jsonp_malloc(array->size * sizeof(json_t *));
+    array->table = jsonp_arena_malloc(arena, array->size * sizeof(json_t *));
     if(!array->table) {
-        jsonp_free(array);
+        jsonp_node_free(arena, array, sizeof(json_array_t));
         return NULL;
     }
 
@@ -357,6 +556,21 @@ json_t *json_array(void)
     return &array->json;
 }
 
+json_t *json_array(void)
+{
+    return json_array_sized(ARRAY_INITIAL_SIZE);
+}
+
+json_t *json_array_sized(size_t size)
+{
+    return array_create(NULL, size);
+}
+
+json_t *json_arena_array(json_arena_t *arena)
+{
+    return array_create(arena, ARRAY_INITIAL_SIZE);
+}
+
 static void json_delete_array(json_array_t *array)
 {
     size_t i;
@@ -365,7 +579,7 @@ static void json_delete_array(json_array_t *array)
         json_decref(array->table[i]);
 
     jsonp_free(array->table);
-    jsonp_free(array);
+    jsonp_node_free(NULL, array, sizeof(json_array_t));
 }
 
 size_t json_array_size(const json_t *json)
@@ -403,7 +617,7 @@ int json_array_set_new(json_t *json, size_t index, json_t *value)
     }
     array = json_to_array(json);
 
-    if(index >= array->entries)
+    if(index >= array->entries || arena_rejects(array->arena, value))
     {
         json_decref(value);
         return -1;
@@ -428,6 +642,57 @@ static void array_copy(json_t **dest, size_t dpos,
     memcpy(&dest[dpos], &src[spos], count * sizeof(json_t *));
 }
 
+/* Reallocate the table to hold exactly size entries */
+static int json_array_resize(json_array_t *array, size_t size)
+{
+    json_t **new_table;
+
+    if(size > (size_t)-1 / sizeof(json_t *))
+        return -1;
+
+    new_table = jsonp_arena_realloc(array->arena, array->table,
+                                    array->entries * sizeof(json_t *),
+                                    size * sizeof(json_t *));
+    if(!new_table)
+        return -1;
+
+    jsonp_count_array_grow();
+    array->table = new_table;
+    array->size = size;
+    return 0;
+}
+
+int json_array_reserve(json_t *json, size_t size)
+{
+    json_array_t *array;
+
+    if(!json_is_array(json))
+        return -1;
+
+    array = json_to_array(json);
+    if(size <= array->size)
+        return 0;
+
+    return json_array_resize(array, size);
+}
+
+int json_array_shrink(json_t *json)
+{
+    json_array_t *array;
+    size_t size;
+
+    if(!json_is_array(json))
+        return -1;
+
+    array = json_to_array(json);
+
+    size = array->entries ? array->entries : 1;
+    if(size == array->size)
+        return 0;
+
+    return json_array_resize(array, size);
+}
+
 static json_t **json_array_grow(json_array_t *array,
                                 size_t amount,
                                 int copy)
@@ -441,19 +706,31 @@ static json_t **json_array_grow(json_array_t *array,
     old_table = array->table;
 
     new_size = max(array->size + amount, array->size * 2);
-    new_table = jsonp_malloc(new_size * sizeof(json_t *));
+    if(new_size > (size_t)-1 / sizeof(json_t *))
+        return NULL;
+
+    if(copy) {
+        /* The entries stay in place, so the table can grow in place */
+        new_table = jsonp_arena_realloc(array->arena, old_table,
+                                        array->entries * sizeof(json_t *),
+                                        new_size * sizeof(json_t *));
+        if(!new_table)
+            return NULL;
+
+        jsonp_count_array_grow();
+        array->size = new_size;
+        array->table = new_table;
+        return new_table;
+    }
+
+    new_table = jsonp_arena_malloc(array->arena, new_size * sizeof(json_t *));
     if(!new_table)
         return NULL;
 
+    jsonp_count_array_grow();
     array->size = new_size;
     array->table = new_table;
 
-    if(copy) {
-        array_copy(array->table, 0, old_table, 0, array->entries);
-        jsonp_free(old_table);
-        return array->table;
-    }
-
     return old_table;
 }
 
@@ -471,7 +748,7 @@ int json_array_append_new(json_t *json, json_t *value)
     }
     array = json_to_array(json);
 
-    if(!json_array_grow(array, 1, 1)) {
+    if(arena_rejects(array->arena, value) || !json_array_grow(array, 1, 1)) {
         json_decref(value);
         return -1;
     }
@@ -496,7 +773,7 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value)
     }
     array = json_to_array(json);
 
-    if(index > array->entries) {
+    if(index > array->entries || arena_rejects(array->arena, value)) {
         json_decref(value);
         return -1;
     }
@@ -511,7 +788,7 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value)
         array_copy(array->table, 0, old_table, 0, index);
         array_copy(array->table, index + 1, old_table, index,
                    array->entries - index);
-        jsonp_free(old_table);
+        jsonp_arena_free(array->arena, old_table);
     }
     else
         array_move(array, index + 1, index, array->entries - index);
@@ -570,6 +847,11 @@ int json_array_extend(json_t *json, json_t *other_json)
     array = json_to_array(json);
     other = json_to_array(other_json);
 
+    for(i = 0; i < other->entries; i++) {
+        if(arena_rejects(array->arena, other->table[i]))
+            return -1;
+    }
+
     if(!json_array_grow(array, other->entries, 1))
         return -1;
 
@@ -609,7 +891,7 @@ static json_t *json_array_copy(json_t *array)
     json_t *result;
     size_t i;
 
-    result = json_array();
+    result = json_array_sized(json_array_size(array));
     if(!result)
         return NULL;
 
@@ -624,7 +906,7 @@ static json_t *json_array_deep_copy(const json_t *array)
     json_t *result;
     size_t i;
 
-    result = json_array();
+    result = json_array_sized(json_array_size(array));
     if(!result)
         return NULL;
 
@@ -636,7 +918,8 @@ static json_t *json_array_deep_copy(const json_t *array)
 
 /*** string ***/
 
-static json_t *string_create(const char *value, size_t len, int own)
+static json_t *string_create(json_arena_t *arena, const char *value,
+                             size_t len, int own)
 {
     char *v;
     json_string_t *string;
@@ -646,19 +929,28 @@ static json_t *string_create(const char *value, size_t len, int own)
 
     if(own)
         v = (char *)value;
+    else if(arena) {
+        if(len == (size_t)-1)
+            return NULL;
+        v = jsonp_arena_malloc(arena, len + 1);
+        if(!v)
+            return NULL;
+        memcpy(v, value, len);
+        v[len] = '\0';
+    }
     else {
         v = jsonp_strndup(value, len);
         if(!v)
             return NULL;
     }
 
-    string = jsonp_malloc(sizeof(json_string_t));
+    string = jsonp_node_malloc(arena, sizeof(json_string_t));
     if(!string) {
         if(!own)
-            jsonp_free(v);
+            jsonp_arena_free(arena, v);
         return NULL;
     }
-    json_init(&string->json, JSON_STRING);
+    json_init(&string->json, JSON_STRING, arena);
     string->value = v;
     string->length = len;
 
@@ -670,18 +962,19 @@ json_t *json_string_nocheck(const char *value)
     if(!value)
         return NULL;
 
-    return string_create(value, strlen(value), 0);
+    return string_create(NULL, value, strlen(value), 0);
 }
 
 json_t *json_stringn_nocheck(const char *value, size_t len)
 {
-    return string_create(value, len, 0);
+    return string_create(NULL, value, len, 0);
 }
 
 /* this is private; "steal" is not a public API concept */
-json_t *jsonp_stringn_nocheck_own(const char *value, size_t len)
+json_t *jsonp_stringn_nocheck_own(json_arena_t *arena, const char *value,
+                                  size_t len)
 {
-    return string_create(value, len, 1);
+    return string_create(arena, value, len, 1);
 }
 
 json_t *json_string(const char *value)
@@ -700,6 +993,22 @@ json_t *json_stringn(const char *value, size_t len)
     return json_stringn_nocheck(value, len);
 }
 
+json_t *json_arena_string(json_arena_t *arena, const char *value)
+{
+    if(!value)
+        return NULL;
+
+    return json_arena_stringn(arena, value, strlen(value));
+}
+
+json_t *json_arena_stringn(json_arena_t *arena, const char *value, size_t len)
+{
+    if(!value || !utf8_check_string(value, len))
+        return NULL;
+
+    return string_create(arena, value, len, 0);
+}
+
 const char *json_string_value(const json_t *json)
 {
     if(!json_is_string(json))
@@ -732,6 +1041,11 @@ int json_string_setn_nocheck(json_t *json, const char *value, size_t len)
     if(!json_is_string(json) || !value)
         return -1;
 
+    /* Strings in an arena can't be changed, as their old value can't
+       be freed */
+    if(json->refcount == (size_t)-1)
+        return -1;
+
     dup = jsonp_strndup(value, len);
     if(!dup)
         return -1;
@@ -763,7 +1077,7 @@ int json_string_setn(json_t *json, const char *value, size_t len)
 static void json_delete_string(json_string_t *string)
 {
     jsonp_free(string->value);
-    jsonp_free(string);
+    jsonp_node_free(NULL, string, sizeof(json_string_t));
 }
 
 static int json_string_equal(json_t *string1, json_t *string2)
@@ -794,10 +1108,15 @@ static json_t *json_string_copy(const json_t *string)
 
 json_t *json_integer(json_int_t value)
 {
-    json_integer_t *integer = jsonp_malloc(sizeof(json_integer_t));
+    return json_arena_integer(NULL, value);
+}
+
+json_t *json_arena_integer(json_arena_t *arena, json_int_t value)
+{
+    json_integer_t *integer = jsonp_node_malloc(arena, sizeof(json_integer_t));
     if(!integer)
         return NULL;
-    json_init(&integer->json, JSON_INTEGER);
+    json_init(&integer->json, JSON_INTEGER, arena);
 
     integer->value = value;
     return &integer->json;
@@ -823,7 +1142,7 @@ int json_integer_set(json_t *json, json_int_t value)
 
 static void json_delete_integer(json_integer_t *integer)
 {
-    jsonp_free(integer);
+    jsonp_node_free(NULL, integer, sizeof(json_integer_t));
 }
 
 static int json_integer_equal(json_t *integer1, json_t *integer2)
@@ -840,16 +1159,21 @@ static json_t *json_integer_copy(const json_t *integer)
 /*** real ***/
 
 json_t *json_real(double value)
+{
+    return json_arena_real(NULL, value);
+}
+
+json_t *json_arena_real(json_arena_t *arena, double value)
 {
     json_real_t *real;
 
     if(isnan(value) || isinf(value))
         return NULL;
 
-    real = jsonp_malloc(sizeof(json_real_t));
+    real = jsonp_node_malloc(arena, sizeof(json_real_t));
     if(!real)
         return NULL;
-    json_init(&real->json, JSON_REAL);
+    json_init(&real->json, JSON_REAL, arena);
 
     real->value = value;
     return &real->json;
@@ -875,7 +1199,7 @@ int json_real_set(json_t *json, double value)
 
 static void json_delete_real(json_real_t *real)
 {
-    jsonp_free(real);
+    jsonp_node_free(NULL, real, sizeof(json_real_t));
 }
 
 static int json_real_equal(json_t *real1, json_t *real2)
@@ -1037,3 +1361,69 @@ json_t *json_deep_copy(const json_t *json)
 
     return NULL;
 }
+
+
+/*** memory usage ***/
+
+static size_t json_object_memory_usage(json_object_t *object)
+{
+    size_t usage;
+    void *iter;
+
+    /* Don't loop forever on a circular reference */
+    if(object->visited)
+        return 0;
+    object->visited = 1;
+
+    usage = sizeof(json_object_t) +
+            hashtable_memory_usage(&object->hashtable);
+    if(object->sorted)
+        usage += object->hashtable.size * sizeof(void *);
+
+    for(iter = hashtable_iter(&object->hashtable); iter;
+        iter = hashtable_iter_next(&object->hashtable, iter))
+        usage += json_memory_usage(hashtable_iter_value(iter));
+
+    object->visited = 0;
+    return usage;
+}
+
+static size_t json_array_memory_usage(json_array_t *array)
+{
+    size_t i, usage;
+
+    if(array->visited)
+        return 0;
+    array->visited = 1;
+
+    usage = sizeof(json_array_t) + array->size * sizeof(json_t *);
+    for(i = 0; i < array->entries; i++)
+        usage += json_memory_usage(array->table[i]);
+
+    array->visited = 0;
+    return usage;
+}
+
+size_t json_memory_usage(const json_t *json)
+{
+    if(!json)
+        return 0;
+
+    if(json_is_object(json))
+        return json_object_memory_usage(json_to_object(json));
+
+    if(json_is_array(json))
+        return json_array_memory_usage(json_to_array(json));
+
+    if(json_is_string(json))
+        return sizeof(json_string_t) + json_to_string(json)->length + 1;
+
+    if(json_is_integer(json))
+        return sizeof(json_integer_t);
+
+    if(json_is_real(json))
+        return sizeof(json_real_t);
+
+    /* true, false and null are not allocated */
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * A seeded 64-bit string hash modelled after wyhash by Wang Yi
+ * (released into the public domain). Input is consumed 16 or 48 bytes
+ * at a time, and every step folds two 64-bit words together with a
+ * 64x64->128-bit multiplication.
+ *
+ * Hash values depend on the byte order of the host. That's fine here,
+ * as they're never stored or sent anywhere.
+ */
+
+#ifndef WYHASH_H
+#define WYHASH_H
+
+#include <string.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+static const uint64_t wyhash_secret[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+/* Multiply *a and *b, store the low half of the result in *a and the
+   high half in *b */
+static JSON_INLINE void wyhash_mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), lo, hi;
+    uint64_t c = t < rl;
+
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static JSON_INLINE uint64_t wyhash_mix(uint64_t a, uint64_t b)
+{
+    wyhash_mum(&a, &b);
+    return a ^ b;
+}
+
+static JSON_INLINE uint64_t wyhash_read8(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static JSON_INLINE uint64_t wyhash_read4(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* 1 to 3 bytes */
+static JSON_INLINE uint64_t wyhash_read3(const unsigned char *p, size_t k)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static uint64_t wyhash(const void *key, size_t len, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    const uint64_t *s = wyhash_secret;
+    uint64_t a, b;
+
+    seed ^= wyhash_mix(seed ^ s[0], s[1]);
+
+    if(len <= 16)
+    {
+        if(len >= 4)
+        {
+            /* Two overlapping reads cover 4 to 16 bytes */
+            size_t m = (len >> 3) << 2;
+            a = (wyhash_read4(p) << 32) | wyhash_read4(p + m);
+            b = (wyhash_read4(p + len - 4) << 32) |
+                wyhash_read4(p + len - 4 - m);
+        }
+        else if(len > 0)
+        {
+            a = wyhash_read3(p, len);
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        size_t i = len;
+
+        if(i > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = wyhash_mix(wyhash_read8(p) ^ s[1], wyhash_read8(p + 8) ^ seed);
+                see1 = wyhash_mix(wyhash_read8(p + 16) ^ s[2], wyhash_read8(p + 24) ^ see1);
+                see2 = wyhash_mix(wyhash_read8(p + 32) ^ s[3], wyhash_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+
+        while(i > 16)
+        {
+            seed = wyhash_mix(wyhash_read8(p) ^ s[1], wyhash_read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        /* The last 16 bytes, possibly overlapping with the above */
+        a = wyhash_read8(p + i - 16);
+        b = wyhash_read8(p + i - 8);
+    }
+
+    a ^= s[1];
+    b ^= seed;
+    wyhash_mum(&a, &b);
+    return wyhash_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2009-2014 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <string.h>
+#include <jansson.h>
+#include "util.h"
+
+static void test_constructors(void)
+{
+    json_arena_t *arena;
+    json_t *object, *array, *value;
+
+    arena = json_arena_create();
+    if(!arena)
+        fail("unable to create arena");
+
+    object = json_arena_object(arena);
+    array = json_arena_array(arena);
+    if(!json_is_object(object) || !json_is_array(array))
+        fail("unable to create arena containers");
+
+    value = json_arena_string(arena, "foo");
+    if(!value || strcmp(json_string_value(value), "foo"))
+        fail("json_arena_string failed");
+    if(json_object_set_new(object, "string", value))
+        fail("unable to add an arena string to an arena object");
+
+    value = json_arena_stringn(arena, "b\0r", 3);
+    if(!value || json_string_length(value) != 3 ||
+       memcmp(json_string_value(value), "b\0r", 4))
+        fail("json_arena_stringn failed");
+    if(json_array_append_new(array, value))
+        fail("unable to add an arena string to an arena array");
+
+    if(json_arena_string(arena, "\xff"))
+        fail("json_arena_string accepted invalid UTF-8");
+    if(json_arena_string(arena, NULL))
+        fail("json_arena_string accepted NULL");
+
+    value = json_arena_integer(arena, 42);
+    if(json_integer_value(value) != 42)
+        fail("json_arena_integer failed");
+    if(json_array_append_new(array, value))
+        fail("unable to add an arena integer to an arena array");
+
+    value = json_arena_real(arena, 1.5);
+    if(json_real_value(value) != 1.5)
+        fail("json_arena_real failed");
+    if(json_array_insert_new(array, 0, value))
+        fail("unable to insert an arena real to an arena array");
+
+    if(json_array_append_new(array, json_true()) ||
+       json_array_append_new(array, json_null()))
+        fail("unable to add true or null to an arena array");
+
+    if(json_object_set(object, "array", array))
+        fail("unable to add an arena array to an arena object");
+
+    /* Reference counting doesn't apply to arena values */
+    json_incref(object);
+    json_decref(object);
+    json_decref(object);
+    if(json_object_size(object) != 2 || json_array_size(array) != 5)
+        fail("json_decref affected an arena value");
+
+    if(!json_string_set(json_object_get(object, "string"), "bar"))
+        fail("json_string_set changed an arena string");
+
+    /* Arena containers grow like any other */
+    while(json_array_size(array) < 1000) {
+        if(json_array_append_new(array, json_arena_integer(arena, 1)))
+            fail("unable to grow an arena array");
+    }
+
+    json_arena_destroy(arena);
+    json_arena_destroy(NULL);
+}
+
+static void test_mixing(void)
+{
+    json_arena_t *arena;
+    json_t *object, *array, *value;
+
+    arena = json_arena_create();
+    object = json_arena_object(arena);
+    array = json_arena_array(arena);
+    if(!object || !array)
+        fail("unable to create arena containers");
+
+    /* Arena containers reject values that are reference counted */
+    if(!json_object_set_new(object, "a", json_integer(1)))
+        fail("an arena object accepted a heap value");
+    if(!json_array_append_new(array, json_string("foo")))
+        fail("an arena array accepted a heap value");
+    if(json_array_append_new(array, json_arena_integer(arena, 1)))
+        fail("unable to add an arena value to an arena array");
+    if(!json_array_set_new(array, 0, json_integer(2)))
+        fail("json_array_set_new put a heap value in an arena array");
+    if(!json_array_insert_new(array, 0, json_integer(2)))
+        fail("json_array_insert_new put a heap value in an arena array");
+
+    value = json_pack("[i]", 1);
+    if(!json_array_extend(array, value))
+        fail("json_array_extend put a heap value in an arena array");
+    if(json_array_size(array) != 1)
+        fail("a rejected value was added to an arena array");
+    json_decref(value);
+
+    /* Heap containers may hold arena values */
+    value = json_array();
+    if(json_array_append(value, array) || json_array_append(value, object))
+        fail("unable to add arena values to a heap array");
+    json_decref(value);
+
+    /* Copies are always made on the heap */
+    json_object_set_new(object, "array", array);
+    value = json_deep_copy(object);
+    if(!json_equal(value, object))
+        fail("json_deep_copy of an arena value failed");
+    if(json_array_append_new(json_object_get(value, "array"), json_integer(2)))
+        fail("a deep copy of an arena value doesn't accept heap values");
+    json_decref(value);
+
+    json_arena_destroy(arena);
+}
+
+static void test_load(void)
+{
+    const char *text =
+        "{\"foo\": [1, 2.5, \"bar\", true, null, {}], \"baz\": {\"a\": \"b\"}}";
+    json_arena_t *arena;
+    json_error_t error;
+    json_t *arena_value, *heap_value;
+    char *dumped;
+
+    arena = json_arena_create();
+    arena_value = json_loads_arena(arena, text, 0, &error);
+    if(!arena_value)
+        fail("json_loads_arena failed");
+
+    heap_value = json_loads(text, 0, &error);
+    if(!json_equal(arena_value, heap_value))
+        fail("json_loads_arena result differs from json_loads");
+    json_decref(heap_value);
+
+    dumped = json_dumps(arena_value, JSON_COMPACT);
+    if(!dumped || strcmp(dumped, "{\"foo\":[1,2.5,\"bar\",true,null,{}],\"baz\":{\"a\":\"b\"}}"))
+        fail("unable to dump a value loaded to an arena");
+    free(dumped);
+
+    arena_value = json_loadb_arena(arena, "[1, 2]", 6, 0, &error);
+    if(json_array_size(arena_value) != 2)
+        fail("json_loadb_arena failed");
+
+    if(json_loads_arena(arena, "[1, 2", 0, &error))
+        fail("json_loads_arena succeeded on invalid input");
+    check_error("']' expected near end of file", "<string>", 1, 5, 5);
+
+    /* Without an arena the result is reference counted as usual */
+    heap_value = json_loads_arena(NULL, "[1]", 0, &error);
+    if(!heap_value || heap_value->refcount != 1)
+        fail("json_loads_arena failed without an arena");
+    json_decref(heap_value);
+
+    json_arena_destroy(arena);
+}
+
+static void run_tests()
+{
+    test_constructors();
+    test_mixing();
+    test_load();
+}
@@ -419,6 +419,69 @@ static void test_array_foreach()
     json_decref(array2);
 }
 
+static void test_reserve()
+{
+    json_t *array, *value;
+    size_t i;
+
+    array = json_array_sized(100);
+    if(!array)
+        fail("unable to create a sized array");
+    if(json_array_size(array) != 0)
+        fail("sized array is not empty");
+
+    for(i = 0; i < 150; i++) {
+        if(json_array_append_new(array, json_integer(i)))
+            fail("unable to append to a sized array");
+    }
+
+    if(json_array_reserve(array, 1000))
+        fail("json_array_reserve failed");
+    if(json_array_reserve(array, 10))
+        fail("json_array_reserve failed for a smaller size");
+    if(json_array_size(array) != 150)
+        fail("json_array_reserve changed the array size");
+
+    for(i = 0; i < 140; i++) {
+        if(json_array_remove(array, 0))
+            fail("unable to remove from the array");
+    }
+
+    if(json_array_shrink(array))
+        fail("json_array_shrink failed");
+    if(json_array_size(array) != 10)
+        fail("json_array_shrink changed the array size");
+    for(i = 0; i < 10; i++) {
+        value = json_array_get(array, i);
+        if(json_integer_value(value) != (json_int_t)(i + 140))
+            fail("wrong value after json_array_shrink");
+    }
+
+    /* the array still grows after shrinking */
+    if(json_array_append_new(array, json_integer(150)))
+        fail("unable to append after json_array_shrink");
+    if(json_integer_value(json_array_get(array, 10)) != 150)
+        fail("wrong value appended after json_array_shrink");
+
+    if(json_array_clear(array) || json_array_shrink(array))
+        fail("unable to shrink an empty array");
+    if(json_array_append_new(array, json_integer(1)) ||
+       json_array_size(array) != 1)
+        fail("unable to append to a shrunk empty array");
+    json_decref(array);
+
+    array = json_array_sized(0);
+    if(!array)
+        fail("unable to create an array with zero size");
+    if(json_array_append_new(array, json_true()))
+        fail("unable to append to an array with zero size");
+    json_decref(array);
+
+    value = json_object();
+    if(!json_array_reserve(value, 10) || !json_array_shrink(value))
+        fail("reserved or shrunk a non-array");
+    json_decref(value);
+}
 
 static void run_tests()
 {
@@ -429,4 +492,5 @@ static void run_tests()
     test_extend();
     test_circular();
     test_array_foreach();
+    test_reserve();
 }
@@ -6,6 +6,7 @@
  */
 
 #include <jansson.h>
+#include <stdio.h>
 #include <string.h>
 #include "util.h"
 
@@ -194,6 +195,185 @@ static void encode_nul_byte()
     json_decref(json);
 }
 
+static void encode_integers()
+{
+    json_int_t max = (((json_int_t)1 << (sizeof(json_int_t) * 8 - 2)) - 1) * 2 + 1;
+    json_int_t values[] = {0, 7, -7, 10, -99, 100, 12345, -123456789, 0, 0};
+    char expected[64];
+    char *result;
+    json_t *json;
+    size_t i;
+
+    values[8] = max;
+    values[9] = -max - 1;
+
+    for(i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        json = json_integer(values[i]);
+        result = json_dumps(json, JSON_ENCODE_ANY);
+
+        sprintf(expected, "%" JSON_INTEGER_FORMAT, values[i]);
+        if(!result || strcmp(result, expected))
+            fail("json_dumps failed to dump an integer");
+
+        free(result);
+        json_decref(json);
+    }
+}
+
+static void encode_with_size()
+{
+    json_t *json;
+    char *result;
+    size_t size = 0;
+
+    json = json_pack("{s:[i, s, n]}", "foo", 1, "bar");
+    result = json_dumpsn(json, &size, JSON_COMPACT);
+    if(!result || size != 22 || strcmp(result, "{\"foo\":[1,\"bar\",null]}"))
+        fail("json_dumpsn failed");
+    free(result);
+
+    result = json_dumpsn(json, NULL, JSON_COMPACT);
+    if(!result || strcmp(result, "{\"foo\":[1,\"bar\",null]}"))
+        fail("json_dumpsn failed with NULL size");
+    free(result);
+    json_decref(json);
+
+    json = json_stringn("nul byte \0 in string", 20);
+    result = json_dumpsn(json, &size, JSON_ENCODE_ANY);
+    if(!result || size != 27 || strlen(result) != 27)
+        fail("json_dumpsn returned a wrong size for an embedded NUL byte");
+    free(result);
+
+    if(json_dumpsn(json, &size, 0))
+        fail("json_dumpsn encoded a string without JSON_ENCODE_ANY");
+    json_decref(json);
+}
+
+static void dump_to_buffer()
+{
+    json_t *json;
+    char buffer[64];
+    size_t size;
+
+    json = json_pack("{s:[i, s, n]}", "foo", 1, "bar");
+
+    size = json_dumpb(json, NULL, 0, JSON_COMPACT);
+    if(size != 22)
+        fail("json_dumpb failed to compute the size");
+
+    memset(buffer, 'x', sizeof(buffer));
+    size = json_dumpb(json, buffer, sizeof(buffer), JSON_COMPACT);
+    if(size != 22 || memcmp(buffer, "{\"foo\":[1,\"bar\",null]}", 22) ||
+       buffer[22] != 'x')
+        fail("json_dumpb failed");
+
+    size = json_dumpb(json, buffer, 22, JSON_COMPACT);
+    if(size != 22 || memcmp(buffer, "{\"foo\":[1,\"bar\",null]}", 22))
+        fail("json_dumpb failed with an exact-size buffer");
+
+    size = json_dumpb(json, buffer, 10, JSON_COMPACT);
+    if(size != 22)
+        fail("json_dumpb failed to return the size for a short buffer");
+
+    json_decref(json);
+
+    json = json_integer(1);
+    if(json_dumpb(json, buffer, sizeof(buffer), 0) != 0)
+        fail("json_dumpb encoded an integer without JSON_ENCODE_ANY");
+    json_decref(json);
+}
+
+/* Dump object with sorted keys, check the order of the keys and
+   return the result decoded */
+static json_t *dump_sorted(const json_t *object)
+{
+    json_t *result, *value;
+    const char *key, *prev = NULL;
+    size_t key_len, prev_len = 0, min_len;
+    char *text;
+    int cmp;
+
+    text = json_dumps(object, JSON_SORT_KEYS | JSON_COMPACT);
+    if(!text)
+        fail("unable to encode with JSON_SORT_KEYS");
+
+    /* the decoder keeps the order of the keys */
+    result = json_loads(text, 0, NULL);
+    free(text);
+    if(!result)
+        fail("unable to decode the sorted output");
+    if(json_object_size(result) != json_object_size(object))
+        fail("sorted output has a wrong number of keys");
+
+    json_object_keylen_foreach(result, key, key_len, value) {
+        if(prev) {
+            min_len = prev_len < key_len ? prev_len : key_len;
+            cmp = memcmp(prev, key, min_len);
+            if(cmp > 0 || (cmp == 0 && prev_len >= key_len))
+                fail("keys are not in sorted order");
+        }
+        prev = key;
+        prev_len = key_len;
+    }
+
+    return result;
+}
+
+static void sort_keys()
+{
+    json_t *object, *result;
+    char buf[32];
+    int i;
+
+    object = json_object();
+
+    /* enough keys for the multikey quicksort, with common prefixes,
+       keys that are prefixes of others and non-ASCII bytes */
+    for(i = 0; i < 1000; i++) {
+        sprintf(buf, "k%d", (i * 7919) % 1000);
+        json_object_set_new(object, buf, json_integer(i));
+    }
+    for(i = 0; i < 200; i++) {
+        sprintf(buf, "a.long.common.prefix.%d", (i * 31) % 200);
+        json_object_set_new(object, buf, json_integer(i));
+    }
+    json_object_set_new(object, "a.long.common.prefix.", json_integer(-5));
+    json_object_set_new(object, "a.long.c", json_integer(-6));
+    json_object_set_new(object, "a.long.common.p", json_integer(-7));
+    json_object_set_new(object, "", json_integer(-1));
+    json_object_set_new(object, "k", json_integer(-2));
+    json_object_set_new(object, "k\xc3\xa9", json_integer(-3));
+    json_object_setn_new(object, "k1\x01", 3, json_integer(-4));
+
+    result = dump_sorted(object);
+    json_decref(result);
+
+    /* the sorted order is cached, changes must show in the output */
+    json_object_set_new(object, "k1", json_string("changed"));
+    json_object_del(object, "k500");
+    json_object_set_new(object, "k50", json_null());
+    json_object_set_new(object, "k5000", json_true());
+
+    result = dump_sorted(object);
+    if(strcmp(json_string_value(json_object_get(result, "k1")), "changed"))
+        fail("replaced value not encoded with JSON_SORT_KEYS");
+    if(json_object_get(result, "k500"))
+        fail("deleted key encoded with JSON_SORT_KEYS");
+    if(!json_is_true(json_object_get(result, "k5000")))
+        fail("added key not encoded with JSON_SORT_KEYS");
+    json_decref(result);
+
+    json_object_clear(object);
+    json_object_set_new(object, "b", json_integer(2));
+    json_object_set_new(object, "a", json_integer(1));
+    result = dump_sorted(object);
+    if(json_object_size(result) != 2)
+        fail("wrong keys encoded after json_object_clear");
+    json_decref(result);
+
+    json_decref(object);
+}
+
 static void run_tests()
 {
     encode_null();
@@ -202,4 +382,8 @@ static void run_tests()
     encode_other_than_array_or_object();
     escape_slashes();
     encode_nul_byte();
+    encode_integers();
+    encode_with_size();
+    dump_to_buffer();
+    sort_keys();
 }
@@ -26,6 +26,85 @@ static int my_writer(const char *buffer, size_t len, void *data) {
     return 0;
 }
 
+struct counting_sink {
+    char buf[8192];
+    size_t off;
+    size_t calls;
+    size_t max;
+};
+
+static int counting_writer(const char *buffer, size_t len, void *data) {
+    struct counting_sink *s = data;
+    if (len > sizeof(s->buf) - s->off) {
+        return -1;
+    }
+    memcpy(s->buf + s->off, buffer, len);
+    s->off += len;
+    s->calls++;
+    if (len > s->max) {
+        s->max = len;
+    }
+    return 0;
+}
+
+static void buffering()
+{
+    struct counting_sink s;
+    json_t *json;
+    char *dumped_to_string;
+    int i;
+
+    json = json_array();
+    for (i = 0; i < 80; i++) {
+        json_array_append_new(json, json_pack("{s:i, s:f, s:s}",
+                                              "i", i, "r", i / 4.0,
+                                              "s", "abcdefghijklmnopqrstuvwxyz"));
+    }
+
+    dumped_to_string = json_dumps(json, JSON_INDENT(2));
+    if (!dumped_to_string)
+        fail("json_dumps failed");
+
+    /* default buffer */
+    memset(&s, 0, sizeof(s));
+    if (json_dump_callback(json, counting_writer, &s, JSON_INDENT(2)))
+        fail("json_dump_callback failed");
+    if (s.off != strlen(dumped_to_string) ||
+        memcmp(s.buf, dumped_to_string, s.off) != 0)
+        fail("json_dump_callback produced wrong output");
+    if (s.calls != (s.off + 4095) / 4096)
+        fail("json_dump_callback did not pass the output in full chunks");
+
+    /* unbuffered */
+    memset(&s, 0, sizeof(s));
+    if (json_dump_callback_ex(json, counting_writer, &s, JSON_INDENT(2), 0))
+        fail("json_dump_callback_ex failed with bufsize 0");
+    if (s.off != strlen(dumped_to_string) ||
+        memcmp(s.buf, dumped_to_string, s.off) != 0)
+        fail("json_dump_callback_ex produced wrong output with bufsize 0");
+    if (s.max > 26 + 2)
+        fail("json_dump_callback_ex buffered output with bufsize 0");
+
+    /* tiny buffer, strings longer than the buffer are passed through */
+    memset(&s, 0, sizeof(s));
+    if (json_dump_callback_ex(json, counting_writer, &s, JSON_INDENT(2), 7))
+        fail("json_dump_callback_ex failed with bufsize 7");
+    if (s.off != strlen(dumped_to_string) ||
+        memcmp(s.buf, dumped_to_string, s.off) != 0)
+        fail("json_dump_callback_ex produced wrong output with bufsize 7");
+
+    /* buffer larger than the output */
+    memset(&s, 0, sizeof(s));
+    if (json_dump_callback_ex(json, counting_writer, &s, JSON_INDENT(2), 65536))
+        fail("json_dump_callback_ex failed with bufsize 65536");
+    if (s.calls != 1 || s.off != strlen(dumped_to_string) ||
+        memcmp(s.buf, dumped_to_string, s.off) != 0)
+        fail("json_dump_callback_ex produced wrong output with bufsize 65536");
+
+    json_decref(json);
+    free(dumped_to_string);
+}
+
 static void run_tests()
 {
     struct my_sink s;
@@ -78,4 +157,6 @@ static void run_tests()
     json_decref(json);
     free(dumped_to_string);
     free(s.buf);
+
+    buffering();
 }
@@ -135,6 +135,82 @@ static void allow_nul()
     json_decref(json);
 }
 
+static void long_strings()
+{
+    char text[128];
+    json_t *json;
+    json_error_t error;
+
+    /* Long runs of plain characters are scanned in bulk */
+    memset(text, 'x', sizeof(text));
+    text[0] = '"';
+    text[50] = '\\';
+    text[51] = 'n';
+    text[sizeof(text) - 2] = '"';
+    text[sizeof(text) - 1] = '\0';
+
+    json = json_loads(text, JSON_DECODE_ANY, &error);
+    if(!json || json_string_length(json) != sizeof(text) - 4)
+        fail("json_loads failed on a long string");
+    if(json_string_value(json)[49] != '\n')
+        fail("json_loads decoded an escape in a long string incorrectly");
+    json_decref(json);
+
+    text[100] = '\t';
+    if(json_loads(text, JSON_DECODE_ANY, &error))
+        fail("json_loads accepted a control character in a long string");
+    check_error("control character 0x9", "<string>", 1, 100, 100);
+
+    /* Multi-byte UTF-8 sequences occupy a single column */
+    text[60] = '\xc3';
+    text[61] = '\xa9';
+    if(json_loads(text, JSON_DECODE_ANY, &error))
+        fail("json_loads accepted a control character in a long string");
+    check_error("control character 0x9", "<string>", 1, 99, 100);
+
+    text[100] = 'x';
+    text[80] = '\xff';
+    if(json_loads(text, JSON_DECODE_ANY, &error))
+        fail("json_loads accepted invalid UTF-8 in a long string");
+    check_error("unable to decode byte 0xff", "<string>", 1, 79, 80);
+}
+
+static void integer_limits()
+{
+    json_int_t max = (((json_int_t)1 << (sizeof(json_int_t) * 8 - 2)) - 1) * 2 + 1;
+    char text[64], message[128];
+    json_t *json;
+    json_error_t error;
+    int length;
+
+    sprintf(text, "%" JSON_INTEGER_FORMAT, max);
+    json = json_loads(text, JSON_DECODE_ANY, &error);
+    if(!json || json_integer_value(json) != max)
+        fail("json_loads failed on the largest integer");
+    json_decref(json);
+
+    sprintf(text, "%" JSON_INTEGER_FORMAT, -max - 1);
+    json = json_loads(text, JSON_DECODE_ANY, &error);
+    if(!json || json_integer_value(json) != -max - 1)
+        fail("json_loads failed on the smallest integer");
+    json_decref(json);
+
+    /* Both limits end in a digit below 9 */
+    length = (int)strlen(text);
+    text[length - 1]++;
+    if(json_loads(text, JSON_DECODE_ANY, &error))
+        fail("json_loads accepted a too small integer");
+    sprintf(message, "too big negative integer near '%s'", text);
+    check_error(message, "<string>", 1, length, length);
+
+    length = sprintf(text, "%" JSON_INTEGER_FORMAT, max);
+    text[length - 1]++;
+    if(json_loads(text, JSON_DECODE_ANY, &error))
+        fail("json_loads accepted a too big integer");
+    sprintf(message, "too big integer near '%s'", text);
+    check_error(message, "<string>", 1, length, length);
+}
+
 static void load_wrong_args()
 {
     json_t *json;
@@ -174,6 +250,138 @@ static void position()
     json_decref(json);
 }
 
+static void load_limits()
+{
+    json_load_limits_t limits;
+    json_error_t error;
+    json_t *json;
+
+    memset(&limits, 0, sizeof(limits));
+    limits.max_depth = 2;
+    json = json_loads_ex(NULL, "[[1]]", 0, &limits, &error);
+    if(!json)
+        fail("json_loads_ex failed within the depth limit");
+    json_decref(json);
+    if(json_loads_ex(NULL, "{\"a\": {\"b\": []}}", 0, &limits, &error))
+        fail("json_loads_ex exceeded the depth limit");
+    check_error("maximum parsing depth reached near '['", "<string>", 1, 13, 13);
+
+    memset(&limits, 0, sizeof(limits));
+    limits.max_string = 3;
+    json = json_loads_ex(NULL, "[\"abc\"]", 0, &limits, &error);
+    if(!json)
+        fail("json_loads_ex failed within the string limit");
+    json_decref(json);
+    if(json_loads_ex(NULL, "{\"abcd\": 1}", 0, &limits, &error))
+        fail("json_loads_ex exceeded the string limit for a key");
+    check_error("maximum string length exceeded near '\"abcd\"'", "<string>", 1, 7, 7);
+    if(json_loads_ex(NULL, "[\"\\u00e4\\u00e4\"]", 0, &limits, &error))
+        fail("json_loads_ex exceeded the string limit with escapes");
+    if(json_loads_ex(NULL, "[\"aaaaaaaaaaaaaaaaaaaaaaaaaaaaa\"]", 0, &limits, &error))
+        fail("json_loads_ex exceeded the string limit for a long string");
+
+    memset(&limits, 0, sizeof(limits));
+    limits.max_elements = 2;
+    if(json_loads_ex(NULL, "[1, 2, 3]", 0, &limits, &error))
+        fail("json_loads_ex exceeded the array element limit");
+    check_error("too many array elements near '3'", "<string>", 1, 8, 8);
+    if(json_loads_ex(NULL, "{\"a\": 1, \"b\": 2, \"c\": 3}", 0, &limits, &error))
+        fail("json_loads_ex exceeded the object member limit");
+    check_error("too many object members near '\"c\"'", "<string>", 1, 20, 20);
+
+    /* A duplicate key replaces the old member */
+    json = json_loads_ex(NULL, "{\"a\": 1, \"a\": 2, \"b\": 3}", 0, &limits, &error);
+    if(json_object_size(json) != 2)
+        fail("json_loads_ex counted a duplicate key as a new member");
+    json_decref(json);
+
+    memset(&limits, 0, sizeof(limits));
+    json = json_loads("[\"foo\", 1, 2.5, {\"bar\": []}]", 0, &error);
+    limits.max_bytes = json_memory_usage(json) + 16;
+    json_decref(json);
+    json = json_loads_ex(NULL, "[\"foo\", 1, 2.5, {\"bar\": []}]", 0, &limits, &error);
+    if(!json)
+        fail("json_loads_ex failed within the size limit");
+    json_decref(json);
+    limits.max_bytes /= 2;
+    if(json_loads_ex(NULL, "[\"foo\", 1, 2.5, {\"bar\": []}]", 0, &limits, &error))
+        fail("json_loads_ex exceeded the size limit");
+    if(strncmp(error.text, "maximum decoded size exceeded", 29))
+        fail("json_loads_ex returned a wrong error for the size limit");
+}
+
+struct chunk_reader {
+    const char *text;
+    size_t length;
+    size_t pos;
+};
+
+static size_t read_chunk(void *buffer, size_t buflen, void *data)
+{
+    struct chunk_reader *reader = (struct chunk_reader *)data;
+    size_t length = reader->length - reader->pos;
+
+    if(length > buflen)
+        length = buflen;
+    memcpy(buffer, reader->text + reader->pos, length);
+    reader->pos += length;
+    return length;
+}
+
+static void load_size_limit_tokens()
+{
+    static char text[100000];
+    json_load_limits_t limits;
+    json_error_t error;
+    struct chunk_reader reader;
+    int i;
+
+    memset(&limits, 0, sizeof(limits));
+    limits.max_bytes = 1024;
+
+    /* Long tokens are rejected before they are buffered in full */
+    for(i = 0; i < 3; i++) {
+        if(i == 0) {
+            memset(text, 'x', sizeof(text));
+            text[0] = '[';
+            text[1] = '"';
+            text[sizeof(text) - 3] = '"';
+        }
+        else {
+            memset(text, i == 1 ? '1' : 't', sizeof(text));
+            text[0] = '[';
+        }
+        text[sizeof(text) - 2] = ']';
+        text[sizeof(text) - 1] = '\0';
+
+        if(json_loads_ex(NULL, text, 0, &limits, &error))
+            fail("json_loads_ex exceeded the size limit with a long token");
+        if(strncmp(error.text, "maximum decoded size exceeded", 29))
+            fail("json_loads_ex returned a wrong error for a long token");
+        if((size_t)error.position > limits.max_bytes + 2)
+            fail("json_loads_ex read too far past the size limit");
+
+        reader.text = text;
+        reader.length = sizeof(text) - 1;
+        reader.pos = 0;
+        if(json_load_callback_ex(NULL, read_chunk, &reader, 0, &limits, &error))
+            fail("json_load_callback_ex exceeded the size limit with a long token");
+        if(strncmp(error.text, "maximum decoded size exceeded", 29))
+            fail("json_load_callback_ex returned a wrong error for a long token");
+        if(reader.pos == reader.length)
+            fail("json_load_callback_ex read a long token in full");
+    }
+
+    /* Containers are charged before they're created */
+    limits.max_bytes = 16;
+    if(json_loads_ex(NULL, "[1]", 0, &limits, &error))
+        fail("json_loads_ex exceeded the size limit with an array");
+    check_error("maximum decoded size exceeded near '['", "<string>", 1, 1, 1);
+    if(json_loads_ex(NULL, "{}", 0, &limits, &error))
+        fail("json_loads_ex exceeded the size limit with an object");
+    check_error("maximum decoded size exceeded near '{'", "<string>", 1, 1, 1);
+}
+
 static void run_tests()
 {
     file_not_found();
@@ -182,6 +390,10 @@ static void run_tests()
     decode_any();
     decode_int_as_real();
     allow_nul();
+    long_strings();
+    integer_limits();
     load_wrong_args();
     position();
+    load_limits();
+    load_size_limit_tokens();
 }
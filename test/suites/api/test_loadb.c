@@ -33,4 +33,17 @@ static void run_tests()
     if(strcmp(error.text, "']' expected near end of file") != 0) {
         fail("json_loadb returned an invalid error message for an unclosed top-level array");
     }
+
+    /* buflen cuts a multi-byte UTF-8 sequence in half */
+    json = json_loadb("[\"\xc3\xa9\"]", 3, 0, &error);
+    if (json) {
+        json_decref(json);
+        fail("json_loadb should have failed on a truncated UTF-8 sequence, but it didn't");
+    }
+    if(strcmp(error.text, "unable to decode byte 0xc3 near '\"'") != 0) {
+        fail("json_loadb returned an invalid error message for a truncated UTF-8 sequence");
+    }
+    if(error.position != 2) {
+        fail("json_loadb returned an invalid position for a truncated UTF-8 sequence");
+    }
 }
@@ -75,8 +75,212 @@ static void test_secure_funcs(void)
     create_and_free_complex_object();
 }
 
+static int blocks_live = 0;
+
+static void *counting_malloc(size_t size)
+{
+    blocks_live++;
+    return malloc(size);
+}
+
+static void counting_free(void *ptr)
+{
+    blocks_live--;
+    free(ptr);
+}
+
+static void test_pool_release(void)
+{
+    json_set_alloc_funcs(counting_malloc, counting_free);
+    create_and_free_complex_object();
+
+    /* Values recycled through node pools are only freed here */
+    json_pool_release();
+    if(blocks_live != 0)
+        fail("json_pool_release() didn't free all cached memory");
+
+    json_set_alloc_funcs(malloc, free);
+}
+
+struct alloc_stats {
+    int live;
+    int reallocs;
+    size_t last_realloc;
+};
+
+static void *ctx_malloc(size_t size, void *ctx)
+{
+    ((struct alloc_stats *)ctx)->live++;
+    return malloc(size);
+}
+
+static void *ctx_realloc(void *ptr, size_t size, void *ctx)
+{
+    ((struct alloc_stats *)ctx)->reallocs++;
+    ((struct alloc_stats *)ctx)->last_realloc = size;
+    return realloc(ptr, size);
+}
+
+static void ctx_free(void *ptr, void *ctx)
+{
+    ((struct alloc_stats *)ctx)->live--;
+    free(ptr);
+}
+
+static void grow_and_free(void)
+{
+    json_t *array;
+    char *dumped;
+    int i;
+
+    array = json_array();
+    for(i = 0; i < 100; i++)
+        json_array_append_new(array, json_string("some longer string"));
+
+    dumped = json_dumps(array, 0);
+    if(!dumped || strlen(dumped) != 100 * 22)
+        fail("unable to encode with custom allocation functions");
+
+    json_decref(array);
+    json_pool_release();
+
+    /* json_dumps() allocates the result with the custom functions */
+    free(dumped);
+}
+
+static void test_ex_funcs(void)
+{
+    struct alloc_stats stats = {0, 0, 0};
+    json_t *array;
+    char *dumped;
+    size_t size;
+    int i;
+
+    json_set_alloc_funcs_ex(ctx_malloc, ctx_realloc, ctx_free, &stats);
+    grow_and_free();
+    if(stats.live != 1)
+        fail("custom allocation with context failed");
+    if(stats.reallocs == 0)
+        fail("growing arrays and strings doesn't use realloc");
+
+    /* The encoder's buffer grows past the output, and the unused end
+       is given back before the result is handed over */
+    array = json_array();
+    for(i = 0; i < 400; i++)
+        json_array_append_new(array, json_string("some longer string"));
+    dumped = json_dumpsn(array, &size, 0);
+    if(!dumped || size != 400 * 22 || stats.last_realloc != size + 1)
+        fail("json_dumpsn didn't trim the unused end of its buffer");
+    json_decref(array);
+    json_pool_release();
+    free(dumped);
+    stats.live--;
+
+    /* Without realloc, memory is allocated, copied and freed instead */
+    stats.live = stats.reallocs = 0;
+    json_set_alloc_funcs_ex(ctx_malloc, NULL, ctx_free, &stats);
+    grow_and_free();
+    if(stats.live != 1 || stats.reallocs != 0)
+        fail("custom allocation without realloc failed");
+
+    /* A missing malloc or free function restores the defaults */
+    stats.live = stats.reallocs = 0;
+    json_set_alloc_funcs_ex(NULL, ctx_realloc, ctx_free, &stats);
+    grow_and_free();
+    json_set_alloc_funcs_ex(ctx_malloc, ctx_realloc, NULL, &stats);
+    grow_and_free();
+    if(stats.live != 0 || stats.reallocs != 0)
+        fail("a NULL malloc or free function didn't restore the defaults");
+
+    json_set_alloc_funcs(malloc, free);
+}
+
+static void test_memory_usage(void)
+{
+    json_t *object, *array, *string, *integer;
+    size_t usage;
+
+    if(json_memory_usage(NULL) != 0 || json_memory_usage(json_true()) != 0)
+        fail("true or NULL uses memory");
+
+    string = json_string("foo");
+    if(json_memory_usage(string) <= 3)
+        fail("json_memory_usage doesn't count the string value");
+
+    integer = json_integer(1);
+    array = json_array();
+    json_array_append(array, integer);
+    json_array_append(array, string);
+    usage = json_memory_usage(array);
+    if(usage <= json_memory_usage(string) + json_memory_usage(integer))
+        fail("json_memory_usage doesn't count array elements");
+
+    object = json_object();
+    json_object_set(object, "array", array);
+    if(json_memory_usage(object) <= usage)
+        fail("json_memory_usage doesn't count object values");
+
+    /* Circular references are only followed once */
+    json_array_append(array, array);
+    if(json_memory_usage(array) != usage)
+        fail("json_memory_usage follows circular references");
+
+    json_array_clear(array);
+    json_decref(integer);
+    json_decref(string);
+    json_decref(array);
+    json_decref(object);
+}
+
+static void test_memory_stats(void)
+{
+    json_memory_stats_t before, after;
+    json_t *object, *array;
+    int i;
+
+    json_pool_release();
+    if(json_memory_stats(&before)) {
+        /* Not built with memory statistics */
+        if(before.allocs != 0 || before.bytes != 0)
+            fail("json_memory_stats returned statistics on failure");
+        return;
+    }
+
+    object = json_object();
+    for(i = 0; i < 100; i++) {
+        char key[16];
+        sprintf(key, "key%d", i);
+        json_object_set_new(object, key, json_integer(i));
+    }
+
+    array = json_array();
+    for(i = 0; i < 100; i++)
+        json_array_append_new(array, json_true());
+    json_object_set_new(object, "array", array);
+
+    json_memory_stats(&after);
+    if(after.allocs <= before.allocs || after.bytes <= before.bytes)
+        fail("json_memory_stats doesn't count allocations");
+    if(after.rehashes == before.rehashes)
+        fail("json_memory_stats doesn't count rehashes");
+    if(after.array_grows == before.array_grows)
+        fail("json_memory_stats doesn't count array growth");
+
+    json_decref(object);
+    json_pool_release();
+
+    json_memory_stats(&after);
+    if(after.bytes != before.bytes ||
+       after.allocs - before.allocs != after.frees - before.frees)
+        fail("json_memory_stats doesn't count frees");
+}
+
 static void run_tests()
 {
     test_simple();
     test_secure_funcs();
+    test_pool_release();
+    test_ex_funcs();
+    test_memory_usage();
+    test_memory_stats();
 }
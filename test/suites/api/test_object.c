@@ -6,6 +6,8 @@
  */
 
 #include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "util.h"
 
@@ -462,8 +464,12 @@ static void test_misc()
 
 static void test_preserve_order()
 {
-    json_t *object;
+    json_t *object, *value;
+    const char *key;
     char *result;
+    int i;
+
+    const char *keys[] = {"foobar", "bazquux", "lorem ipsum", "sit amet", "helicopter"};
 
     const char *expected = "{\"foobar\": 1, \"bazquux\": 6, \"lorem ipsum\": 3, \"sit amet\": 5, \"helicopter\": 7}";
 
@@ -490,8 +496,25 @@ static void test_preserve_order()
         fprintf(stderr, "%s != %s", expected, result);
         fail("JSON_PRESERVE_ORDER doesn't work");
     }
+    free(result);
 
+    /* insertion order is the default */
+    result = json_dumps(object, 0);
+    if(strcmp(expected, result) != 0) {
+        fprintf(stderr, "%s != %s", expected, result);
+        fail("keys are not dumped in insertion order by default");
+    }
     free(result);
+
+    i = 0;
+    json_object_foreach(object, key, value) {
+        if(i >= 5 || strcmp(key, keys[i]))
+            fail("json_object_foreach doesn't iterate in insertion order");
+        i++;
+    }
+    if(i != 5)
+        fail("json_object_foreach didn't iterate all keys");
+
     json_decref(object);
 }
 
@@ -513,6 +536,358 @@ static void test_object_foreach()
     json_decref(object2);
 }
 
+static void test_small_objects()
+{
+    json_t *object, *value;
+    char buf[32];
+    int i, j;
+
+    object = json_object();
+    if(!object)
+        fail("unable to create object");
+
+    /* Sizes around the point where the object gets an index */
+    for(i = 1; i <= 12; i++) {
+        for(j = 0; j < i; j++) {
+            sprintf(buf, "k%d", j);
+            if(json_object_set_new(object, buf, json_integer(j)))
+                fail("unable to set value");
+        }
+
+        /* replace the first one */
+        if(json_object_set_new(object, "k0", json_integer(-1)) ||
+           json_object_size(object) != (size_t)i)
+            fail("unable to replace a value");
+
+        for(j = 0; j < i; j++) {
+            sprintf(buf, "k%d", j);
+            value = json_object_get(object, buf);
+            if(!value || json_integer_value(value) != (j ? j : -1))
+                fail("wrong value for key");
+        }
+        if(json_object_get(object, "k12"))
+            fail("got a value for a nonexisting key");
+
+        if(json_object_del(object, "k0") || !json_object_del(object, "k0") ||
+           json_object_size(object) != (size_t)i - 1)
+            fail("unable to delete from a small object");
+
+        if(json_object_clear(object) || json_object_size(object) != 0)
+            fail("unable to clear a small object");
+    }
+
+    json_decref(object);
+}
+
+#define NUM_KEYS 10000
+
+static void test_many_keys()
+{
+    json_t *object, *value;
+    const char *key;
+    void *iter, *next;
+    char buf[32];
+    int i, round;
+
+    object = json_object();
+    if(!object)
+        fail("unable to create object");
+
+    /* Grow the object and delete from it repeatedly, so that the
+       index is rebuilt, also incrementally, and has both deleted and
+       empty slots */
+    for(round = 0; round < 4; round++) {
+        for(i = 0; i < NUM_KEYS; i++) {
+            sprintf(buf, "key%d", i);
+            if(json_object_set_new(object, buf, json_integer(i + round)))
+                fail("unable to set value");
+
+            /* also look up while the index is being rebuilt */
+            sprintf(buf, "key%d", i / 2);
+            if(!json_object_get(object, buf))
+                fail("unable to get a value while growing");
+        }
+        if(json_object_size(object) != NUM_KEYS)
+            fail("wrong object size after set");
+
+        for(i = 0; i < NUM_KEYS; i++) {
+            sprintf(buf, "key%d", i);
+            value = json_object_get(object, buf);
+            if(!value || json_integer_value(value) != i + round)
+                fail("wrong value for key");
+        }
+
+        for(i = round % 2; i < NUM_KEYS; i += 2) {
+            sprintf(buf, "key%d", i);
+            if(json_object_del(object, buf))
+                fail("unable to delete an existing key");
+        }
+        if(json_object_size(object) != NUM_KEYS / 2)
+            fail("wrong object size after delete");
+
+        for(i = 0; i < NUM_KEYS; i++) {
+            sprintf(buf, "key%d", i);
+            value = json_object_get(object, buf);
+            if((i % 2 == round % 2) != (value == NULL))
+                fail("deleted key found or remaining key not found");
+        }
+    }
+
+    /* Delete every key while iterating */
+    i = 0;
+    iter = json_object_iter(object);
+    while(iter) {
+        next = json_object_iter_next(object, iter);
+        key = json_object_iter_key(iter);
+        if(json_object_del(object, key))
+            fail("unable to delete a key while iterating");
+        iter = next;
+        i++;
+    }
+    if(i != NUM_KEYS / 2 || json_object_size(object) != 0)
+        fail("iterating while deleting failed");
+
+    json_decref(object);
+}
+
+static void test_delete_while_growing()
+{
+    json_t *object;
+    char buf[32];
+    int i;
+
+    object = json_object();
+    if(!object)
+        fail("unable to create object");
+
+    /* Delete keys that may be in either the old or the new index */
+    for(i = 0; i < 2 * NUM_KEYS; i++) {
+        sprintf(buf, "key%d", i);
+        if(json_object_set_new(object, buf, json_integer(i)))
+            fail("unable to set value");
+
+        if(i % 3 == 0) {
+            sprintf(buf, "key%d", i / 3);
+            if(json_object_del(object, buf))
+                fail("unable to delete while growing");
+        }
+    }
+
+    for(i = 0; i < 2 * NUM_KEYS; i++) {
+        /* key k was deleted after adding key 3k */
+        int deleted = 3 * i < 2 * NUM_KEYS;
+        sprintf(buf, "key%d", i);
+        if((json_object_get(object, buf) == NULL) != deleted)
+            fail("wrong key deleted while growing");
+    }
+
+    json_decref(object);
+}
+
+static void test_keylen()
+{
+    json_t *object, *copy, *value;
+    const char *key;
+    size_t key_len, count = 0;
+    char *result;
+    const char buffer[] = "id\0type";
+
+    object = json_object();
+    if(!object)
+        fail("unable to create object");
+
+    /* keys sliced out of a buffer */
+    if(json_object_setn_new(object, buffer, 2, json_integer(1)) ||
+       json_object_setn_new(object, buffer + 3, 4, json_integer(2)))
+        fail("json_object_setn_new failed");
+
+    value = json_object_getn(object, "identifier", 2);
+    if(!value || json_integer_value(value) != 1)
+        fail("json_object_getn failed");
+    if(json_object_getn(object, "ty", 2))
+        fail("json_object_getn found a prefix of a key");
+    if(json_integer_value(json_object_get(object, "type")) != 2)
+        fail("json_object_get failed for a key set with json_object_setn_new");
+
+    /* a key with a NUL byte is distinct from its prefix */
+    if(json_object_setn_new_nocheck(object, buffer, 7, json_integer(3)))
+        fail("json_object_setn_new_nocheck failed");
+    if(json_object_size(object) != 3)
+        fail("key with a NUL byte replaced its prefix");
+    value = json_object_getn(object, buffer, 7);
+    if(!value || json_integer_value(value) != 3)
+        fail("json_object_getn failed for a key with a NUL byte");
+
+    json_object_keylen_foreach(object, key, key_len, value) {
+        if(key_len != strlen(key) && key_len != 7)
+            fail("json_object_keylen_foreach returned a wrong key length");
+        count++;
+    }
+    if(count != 3)
+        fail("json_object_keylen_foreach failed to iterate all keys");
+
+    copy = json_deep_copy(object);
+    if(!copy || json_object_size(copy) != 3 || !json_equal(object, copy))
+        fail("copying an object with a NUL byte in a key failed");
+    json_decref(copy);
+
+    result = json_dumps(object, JSON_SORT_KEYS | JSON_COMPACT);
+    if(!result || strcmp(result, "{\"id\":1,\"id\\u0000type\":3,\"type\":2}"))
+        fail("dumping a key with a NUL byte failed");
+    free(result);
+
+    if(!json_object_setn_new(object, "\xff", 1, json_integer(4)))
+        fail("json_object_setn_new accepted invalid UTF-8");
+
+    if(json_object_deln(object, buffer, 7) || !json_object_deln(object, buffer, 7))
+        fail("json_object_deln failed");
+    if(json_object_size(object) != 2 || !json_object_getn(object, buffer, 2))
+        fail("json_object_deln deleted the wrong key");
+
+    json_decref(object);
+}
+
+static void test_key_handles()
+{
+    json_t *object1, *object2, *value;
+    json_key_t *id, *type, *missing;
+
+    id = json_key_make("id");
+    type = json_key_maken("type_", 4);
+    missing = json_key_make("missing");
+    if(!id || !type || !missing)
+        fail("json_key_make failed");
+
+    if(json_key_make(NULL))
+        fail("json_key_make succeeded for NULL");
+
+    object1 = json_pack("{si, ss}", "id", 1, "type", "a");
+    object2 = json_pack("{si, si, si, si, si, si, si, si, si, si, ss}",
+                        "a", 1, "b", 2, "c", 3, "d", 4, "e", 5, "f", 6,
+                        "g", 7, "h", 8, "i", 9, "id", 2, "type", "b");
+    if(!object1 || !object2)
+        fail("unable to create objects");
+
+    value = json_object_get_by_key(object1, id);
+    if(!value || json_integer_value(value) != 1)
+        fail("json_object_get_by_key failed for a small object");
+
+    value = json_object_get_by_key(object2, id);
+    if(!value || json_integer_value(value) != 2)
+        fail("json_object_get_by_key failed for a large object");
+
+    value = json_object_get_by_key(object2, type);
+    if(!value || strcmp(json_string_value(value), "b"))
+        fail("json_object_get_by_key failed for a key made with json_key_maken");
+
+    if(json_object_get_by_key(object1, missing) ||
+       json_object_get_by_key(object2, missing))
+        fail("json_object_get_by_key found a nonexisting key");
+
+    if(json_object_get_by_key(object1, NULL) ||
+       json_object_get_by_key(NULL, id))
+        fail("json_object_get_by_key succeeded with NULL arguments");
+
+    json_decref(object1);
+    json_decref(object2);
+    json_key_free(id);
+    json_key_free(type);
+    json_key_free(missing);
+    json_key_free(NULL);
+}
+
+static void test_reserve()
+{
+    json_t *object, *value;
+    void *iter;
+    char buf[32];
+    int i;
+
+    object = json_object_sized(NUM_KEYS);
+    if(!object)
+        fail("unable to create a sized object");
+    if(json_object_size(object) != 0)
+        fail("sized object is not empty");
+
+    for(i = 0; i < NUM_KEYS; i++) {
+        sprintf(buf, "key%d", i);
+        if(json_object_set_new(object, buf, json_integer(i)))
+            fail("unable to set value in a sized object");
+    }
+
+    if(json_object_reserve(object, 2 * NUM_KEYS))
+        fail("json_object_reserve failed");
+    if(json_object_reserve(object, 10))
+        fail("json_object_reserve failed for a smaller size");
+
+    /* shrink to a smaller index, then to no index at all */
+    for(i = 10; i < NUM_KEYS; i++) {
+        sprintf(buf, "key%d", i);
+        if(json_object_del(object, buf))
+            fail("unable to delete a key");
+
+        if(i == NUM_KEYS / 2 && json_object_shrink(object))
+            fail("json_object_shrink failed");
+    }
+    if(json_object_shrink(object))
+        fail("json_object_shrink failed");
+    if(json_object_size(object) != 10)
+        fail("json_object_shrink changed the object size");
+
+    for(i = 6; i < 10; i++) {
+        sprintf(buf, "key%d", i);
+        if(json_object_del(object, buf))
+            fail("unable to delete a key");
+    }
+    if(json_object_shrink(object))
+        fail("json_object_shrink failed for a small object");
+    if(json_object_size(object) != 6)
+        fail("json_object_shrink changed the object size");
+
+    for(i = 0; i < NUM_KEYS; i++) {
+        sprintf(buf, "key%d", i);
+        value = json_object_get(object, buf);
+        if((i < 6) != (value != NULL))
+            fail("wrong keys after json_object_shrink");
+        if(value && json_integer_value(value) != i)
+            fail("wrong value after json_object_shrink");
+    }
+
+    /* the object grows and gets a new index after shrinking */
+    for(i = 6; i < 100; i++) {
+        sprintf(buf, "key%d", i);
+        if(json_object_set_new(object, buf, json_integer(i)))
+            fail("unable to set value after json_object_shrink");
+    }
+    for(i = 0; i < 100; i++) {
+        sprintf(buf, "key%d", i);
+        value = json_object_get(object, buf);
+        if(!value || json_integer_value(value) != i)
+            fail("wrong value after growing a shrunk object");
+    }
+    if(json_object_shrink(object))
+        fail("json_object_shrink failed");
+
+    /* insertion order survives shrinking and growing */
+    i = 0;
+    iter = json_object_iter(object);
+    while(iter) {
+        sprintf(buf, "key%d", i);
+        if(strcmp(json_object_iter_key(iter), buf))
+            fail("wrong iteration order after json_object_shrink");
+        iter = json_object_iter_next(object, iter);
+        i++;
+    }
+    if(i != 100)
+        fail("wrong number of keys after growing a shrunk object");
+    json_decref(object);
+
+    value = json_array();
+    if(!json_object_reserve(value, 10) || !json_object_shrink(value))
+        fail("reserved or shrunk a non-object");
+    json_decref(value);
+}
+
 static void run_tests()
 {
     test_misc();
@@ -524,4 +899,10 @@ static void run_tests()
     test_iterators();
     test_preserve_order();
     test_object_foreach();
+    test_small_objects();
+    test_many_keys();
+    test_delete_while_growing();
+    test_keylen();
+    test_key_handles();
+    test_reserve();
 }
@@ -102,6 +102,16 @@ static void run_tests()
     if(value)
         fail("json_string(<invalid utf-8>) failed");
 
+    /* long strings are validated in blocks */
+    value = json_string("\xc3\xa9t\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 0123456789abcdef");
+    if(!value)
+        fail("json_string(<long utf-8>) failed");
+    json_decref(value);
+
+    value = json_string("0123456789abcdef0123456789\xe2\x82 abcdef");
+    if(value)
+        fail("json_string(<long invalid utf-8>) failed");
+
     value = json_string_nocheck("foo");
     if(!value)
         fail("json_string_nocheck failed");